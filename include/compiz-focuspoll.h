@@ -21,7 +21,7 @@
 #ifndef _COMPIZ_FOCUSPOLL_H
 #define _COMPIZ_FOCUSPOLL_H
 
-#define FOCUSPOLL_ABIVERSION 20191015
+#define FOCUSPOLL_ABIVERSION 20261018
 
 typedef int FocusPollingHandle;
 
@@ -34,6 +34,9 @@ typedef struct _FocusEventNode {
   int            height;
 } FocusEventNode;
 
+/* Called with the focus events that arrived since the last call, at most
+   once per poll interval. It is only called when there are events, never
+   with an empty list and never just because time has passed. */
 typedef void (*FocusUpdateProc) (CompScreen *s,
 				 FocusEventNode *first);
 
@@ -0,0 +1,130 @@
+/*
+ * Compiz JPEG image format plugin
+ *
+ * Copyright: (C) 2006 Nicholas Thomas
+ *		       Danny Baumann (JPEG writing, option stuff)
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#ifndef _COMPIZ_IMGJPEG_H
+#define _COMPIZ_IMGJPEG_H
+
+#define IMGJPEG_ABIVERSION 20261018
+
+/**
+ * Prototype of scaled image loading function
+ *
+ * Works like the core fileToImage function, but JPEG images are decoded
+ * at the smallest 1/8 scale step that is still at least as large as the
+ * given target size. The aspect ratio is kept. Other image formats are
+ * passed on to fileToImage and loaded at full size.
+ *
+ * @param d             display the image is loaded for
+ * @param path          directory of the image, may be NULL
+ * @param name          file name of the image
+ * @param targetWidth   width the image will be displayed at,
+ *                      0 if it doesn't matter
+ * @param targetHeight  height the image will be displayed at,
+ *                      0 if it doesn't matter
+ * @param width         filled with the width of the decoded image
+ * @param height        filled with the height of the decoded image
+ * @param stride        filled with the stride of the decoded image
+ * @param data          filled with the ARGB32 image data
+ *
+ * @return              TRUE on success, FALSE on failure
+ */
+typedef Bool
+(*FileToImageScaledProc) (CompDisplay *d,
+			  const char  *path,
+			  const char  *name,
+			  int         targetWidth,
+			  int         targetHeight,
+			  int         *width,
+			  int         *height,
+			  int         *stride,
+			  void        **data);
+
+/**
+ * Prototype of the function called when a background write is finished
+ *
+ * @param d         display the image was written for
+ * @param fileName  full name of the written file
+ * @param success   whether the image was written successfully
+ * @param closure   closure passed to imageToFileAsync
+ */
+typedef void
+(*ImageWrittenProc) (CompDisplay *d,
+		     const char  *fileName,
+		     Bool        success,
+		     void        *closure);
+
+/**
+ * Prototype of background JPEG writing function
+ *
+ * Compresses and writes the image in a separate thread, with the
+ * quality set in the plugin options. On success, the plugin takes over
+ * the image data and frees it with free () once it has been written.
+ * The callback is called from the main loop after the file has been
+ * written, but not anymore once the plugin is being unloaded.
+ *
+ * @param d        display the image is written for
+ * @param path     directory of the image, may be NULL
+ * @param name     file name of the image
+ * @param width    width of the image
+ * @param height   height of the image
+ * @param stride   stride of the image
+ * @param data     image data as passed to imageToFile
+ * @param written  function called once the write is finished, may be NULL
+ * @param closure  passed to the written callback
+ *
+ * @return         TRUE if the write was queued, FALSE on failure
+ */
+typedef Bool
+(*ImageToFileAsyncProc) (CompDisplay      *d,
+			 const char       *path,
+			 const char       *name,
+			 int              width,
+			 int              height,
+			 int              stride,
+			 void             *data,
+			 ImageWrittenProc written,
+			 void             *closure);
+
+/**
+ * Prototype of image prefetching function
+ *
+ * Starts decoding the given JPEG images in background threads. Later
+ * fileToImage calls for one of these files take the decoded image
+ * instead of decoding it again, waiting for the decode to finish if
+ * needed. Files which aren't JPEG images are ignored. Decoded images
+ * are kept until they are loaded, so only prefetch images which will
+ * be loaded soon.
+ *
+ * @param d       display the images will be loaded for
+ * @param path    directory of the images, may be NULL
+ * @param names   file names of the images
+ * @param nNames  number of file names
+ */
+typedef void
+(*PrefetchImagesProc) (CompDisplay *d,
+		       const char  *path,
+		       const char  **names,
+		       int         nNames);
+
+typedef struct _ImgJpegFunc {
+    FileToImageScaledProc fileToImageScaled;
+    ImageToFileAsyncProc  imageToFileAsync;
+    PrefetchImagesProc    prefetchImages;
+} ImgJpegFunc;
+
+#endif
@@ -21,7 +21,7 @@
 #ifndef _COMPIZ_MOUSEPOLL_H
 #define _COMPIZ_MOUSEPOLL_H
 
-#define MOUSEPOLL_ABIVERSION 20080116
+#define MOUSEPOLL_ABIVERSION 20261019
 
 typedef int PositionPollingHandle;
 
@@ -42,10 +42,29 @@ typedef void
 			   int        *x,
 			   int        *y);
 
+/* Like AddPositionPollingProc, but update is called at most once every
+   interval ms. Intervals shorter than the mousepoll plugin setting are
+   raised to it. */
+typedef PositionPollingHandle
+(*AddPositionPollingWithRateProc) (CompScreen         *s,
+				   PositionUpdateProc update,
+				   int                interval);
+
+/* Returns the pointer position extrapolated delay ms into the future,
+   e.g. to the next redraw, from the recent pointer movement. Returns
+   FALSE and the current position if the pointer is not moving. */
+typedef Bool
+(*GetPredictedPositionProc) (CompScreen *s,
+			     int        delay,
+			     int        *x,
+			     int        *y);
+
 typedef struct _MousePollFunc {
-   AddPositionPollingProc    addPositionPolling;
-   RemovePositionPollingProc removePositionPolling;
-   GetCurrentPositionProc    getCurrentPosition;
+   AddPositionPollingProc         addPositionPolling;
+   RemovePositionPollingProc      removePositionPolling;
+   GetCurrentPositionProc         getCurrentPosition;
+   AddPositionPollingWithRateProc addPositionPollingWithRate;
+   GetPredictedPositionProc       getPredictedPosition;
 } MousePollFunc;
 
 #endif
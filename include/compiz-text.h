@@ -21,7 +21,7 @@
 #ifndef _COMPIZ_TEXT_H
 #define _COMPIZ_TEXT_H
 
-#define TEXT_ABIVERSION 20090103
+#define TEXT_ABIVERSION 20261018
 
 /**
  * Flags to be passed into the flags field of CompTextAttrib
@@ -66,6 +66,20 @@ typedef struct _CompTextData {
     unsigned int height;   /**< pixmap height */
 } CompTextData;
 
+/**
+ * Output data structure that holds the extents of a text
+ */
+typedef struct _CompTextExtents {
+    unsigned int width;      /**< width of the pixmap renderText would
+				  generate */
+    unsigned int height;     /**< height of that pixmap */
+    unsigned int textWidth;  /**< width of the text itself after
+				  ellipsizing, excluding background
+				  margins */
+    Bool         ellipsized; /**< whether the text had to be ellipsized
+				  to fit into the maximum width */
+} CompTextExtents;
+
 /**
  * Prototype of text-to-pixmap rendering function
  *
@@ -97,6 +111,25 @@ typedef CompTextData *
 			  Bool                 withViewportNumber,
 			  const CompTextAttrib *attrib);
 
+/**
+ * Prototype of text measuring function
+ *
+ * Lays out the text exactly like the rendering function would,
+ * but doesn't allocate a pixmap or render anything.
+ *
+ * @param s        screen the text would be rendered on
+ * @param text     text to be measured in ASCII or UTF-8 encoding
+ * @param attrib   text rendering attributes
+ * @param extents  filled with the text extents on success
+ *
+ * @return         TRUE on success, FALSE on failure
+ */
+typedef Bool
+(*MeasureTextProc) (CompScreen           *s,
+		    const char           *text,
+		    const CompTextAttrib *attrib,
+		    CompTextExtents      *extents);
+
 /**
  * Prototype of function drawing text data on screen
  *
@@ -138,6 +171,7 @@ typedef struct _TextFunc {
     RenderWindowTitleProc renderWindowTitle;
     DrawTextProc          drawText;
     FiniTextDataProc      finiTextData;
+    MeasureTextProc       measureText;
 } TextFunc;
 
 #endif
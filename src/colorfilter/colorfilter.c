@@ -42,6 +42,13 @@
 
 #define NOTIFICATION_ICON ICONSDIR "/scalable/apps/plugin-colorfilter.svg"
 
+/* Number of windows updated at once after a match setting change */
+#define MATCH_UPDATE_BATCH_SIZE 32
+
+/* Pending match updates, see colorFilterApplyMatchUpdate */
+#define MATCH_UPDATE_FILTER  (1 << 0)
+#define MATCH_UPDATE_EXCLUDE (1 << 1)
+
 static int displayPrivateIndex;
 static int corePrivateIndex;
 
@@ -52,6 +59,9 @@ typedef struct _ColorFilterCore {
 typedef struct _ColorFilterDisplay
 {
     int		    screenPrivateIndex;
+
+    MatchPropertyChangedProc   matchPropertyChanged;
+    MatchExpHandlerChangedProc matchExpHandlerChanged;
 } ColorFilterDisplay;
 
 typedef struct _ColorFilterScreen
@@ -64,14 +74,21 @@ typedef struct _ColorFilterScreen
     int			    currentFilter; /* 0 : cumulative mode
 					      0 < c <= count : single mode */
 
-    /* The plugin can not immediately load the filters because it needs to
-     * know what texture target it will use : when required, this boolean
-     * is set to TRUE and filters will be loaded on next filtered window
-     * texture painting */
+    /* Filters are built for every fetch target, so windows using different
+     * texture targets always get a matching program.  They are built on
+     * the first filtered painting, once the options are loaded and every
+     * window got its private, and rebuilt right away when the filters list
+     * changes afterwards */
     Bool		    filtersLoaded;
-    int			    *filtersFunctions;
+    int			    *filtersFunctions[COMP_FETCH_TARGET_NUM];
     int			    filtersCount;
 
+    /* Loaded filters fused together for the cumulative mode */
+    int			    *cumulativeFunctions[COMP_FETCH_TARGET_NUM];
+    int			    cumulativeCount[COMP_FETCH_TARGET_NUM];
+
+    CompTimeoutHandle	    matchUpdateHandle;
+
 #ifdef HAVE_LIBNOTIFY
     NotifyNotification	    *notification;
 #endif
@@ -80,6 +97,13 @@ typedef struct _ColorFilterScreen
 typedef struct _ColorFilterWindow
 {
     Bool    isFiltered;
+
+    /* Cached match results, only evaluated again when the window
+     * properties or the match settings change */
+    Bool	 matchesValid;
+    Bool	 filterMatched;
+    Bool	 excludeMatched;
+    unsigned int matchUpdate;
 } ColorFilterWindow;
 
 #define GET_FILTER_CORE(c) \
@@ -133,6 +157,44 @@ findFragmentFunction (CompScreen *s, int id)
     return NULL;
 }
 
+/* Match caching functions -------------------------------------------------- */
+
+/*
+ * Get cached match results for a window, evaluating them if needed
+ */
+static void
+colorFilterUpdateMatches (CompWindow *w)
+{
+    FILTER_WINDOW (w);
+
+    if (cfw->matchesValid)
+	return;
+
+    cfw->filterMatched = matchEval (colorfilterGetFilterMatch (w->screen), w);
+    cfw->excludeMatched = matchEval (colorfilterGetExcludeMatch (w->screen), w);
+    cfw->matchesValid = TRUE;
+}
+
+static Bool
+colorFilterWindowIsMatched (CompWindow *w)
+{
+    FILTER_WINDOW (w);
+
+    colorFilterUpdateMatches (w);
+
+    return cfw->filterMatched;
+}
+
+static Bool
+colorFilterWindowIsExcluded (CompWindow *w)
+{
+    FILTER_WINDOW (w);
+
+    colorFilterUpdateMatches (w);
+
+    return cfw->excludeMatched;
+}
+
 /* Actions handling functions ----------------------------------------------- */
 
 /*
@@ -147,7 +209,7 @@ colorFilterToggleWindow (CompWindow * w)
     cfw->isFiltered = !cfw->isFiltered;
 
     /* Check exclude list */
-    if (matchEval (colorfilterGetExcludeMatch (w->screen), w))
+    if (colorFilterWindowIsExcluded (w))
 	cfw->isFiltered = FALSE;
 
     /* Ensure window is going to be repainted */
@@ -226,7 +288,7 @@ colorFilterSwitchFilter (CompScreen * s, CompBool userAction)
     }
     else
     {
-	id = cfs->filtersFunctions[cfs->currentFilter - 1];
+	id = cfs->filtersFunctions[COMP_FETCH_TARGET_2D][cfs->currentFilter - 1];
 	if (id)
 	{
 	    function = findFragmentFunction (s, id);
@@ -317,34 +379,49 @@ colorFilterSwitch (CompDisplay * d, CompAction * action,
 static void
 unloadFilters (CompScreen *s)
 {
-    int i;
+    int i, target;
 
     FILTER_SCREEN (s);
 
-    if (cfs->filtersFunctions)
+    for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
     {
+	if (cfs->cumulativeFunctions[target])
+	{
+	    for (i = 0; i < cfs->cumulativeCount[target]; i++)
+		destroyFragmentFunction (s, cfs->cumulativeFunctions[target][i]);
+	    free (cfs->cumulativeFunctions[target]);
+	    cfs->cumulativeFunctions[target] = NULL;
+	}
+	cfs->cumulativeCount[target] = 0;
+
+	if (!cfs->filtersFunctions[target])
+	    continue;
+
 	/* Destroy loaded filters one by one */
 	for (i = 0; i < cfs->filtersCount; i++)
 	{
-	    if (cfs->filtersFunctions[i])
-		destroyFragmentFunction (s, cfs->filtersFunctions[i]);
+	    if (cfs->filtersFunctions[target][i])
+		destroyFragmentFunction (s, cfs->filtersFunctions[target][i]);
 	}
-	free (cfs->filtersFunctions);
-	cfs->filtersFunctions = NULL;
-	cfs->filtersCount = 0;
-	/* Reset current filter */
-	cfs->currentFilter = 0;
+	free (cfs->filtersFunctions[target]);
+	cfs->filtersFunctions[target] = NULL;
     }
+
+    cfs->filtersCount = 0;
+    /* Reset current filter */
+    cfs->currentFilter = 0;
 }
 
 /*
- * Load filters from a list of files for current screen
+ * Load filters from a list of files for current screen, once for each
+ * texture target
  */
 static int
-loadFilters (CompScreen *s, CompTexture *texture)
+loadFilters (CompScreen *s)
 {
-    int i, target, loaded, function, count;
-    char *name;
+    int i, target, loaded, count, nFiles;
+    Bool ok;
+    char *name, **files;
     CompListValue *filters;
     CompWindow *w;
 
@@ -356,17 +433,17 @@ loadFilters (CompScreen *s, CompTexture *texture)
     filters = colorfilterGetFilters (s);
     count = filters->nValue;
 
-    /* The texture target that will be used for some ops */
-    if (texture->target == GL_TEXTURE_2D)
-	target = COMP_FETCH_TARGET_2D;
-    else
-	target = COMP_FETCH_TARGET_RECT;
-
     /* Free previously loaded filters and malloc */
     unloadFilters (s);
-    cfs->filtersFunctions = malloc (sizeof (int) * count);
-    if (!cfs->filtersFunctions)
-	return 0;
+    for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
+    {
+	cfs->filtersFunctions[target] = calloc (count, sizeof (int));
+	if (!cfs->filtersFunctions[target])
+	{
+	    unloadFilters (s);
+	    return 0;
+	}
+    }
     cfs->filtersCount = count;
 
     /* Load each filter one by one */
@@ -379,18 +456,60 @@ loadFilters (CompScreen *s, CompTexture *texture)
 	    if (name)
 		free (name);
 
-	    cfs->filtersFunctions[i] = 0;
 	    continue;
 	}
 
 	compLogMessage ("colorfilter", CompLogLevelInfo,
 			"Loading filter %s (item %s).", name,
 			filters->value[i].s);
-	function = loadFragmentProgram (filters->value[i].s, name, s, target);
+
+	/* A filter is only usable if it could be built for every target,
+	 * otherwise it would silently be skipped for some windows */
+	ok = TRUE;
+	for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
+	{
+	    cfs->filtersFunctions[target][i] =
+		loadFragmentProgram (filters->value[i].s, name, s, target);
+	    if (!cfs->filtersFunctions[target][i])
+		ok = FALSE;
+	}
 	free (name);
-	cfs->filtersFunctions[i] = function;
-	if (function)
+
+	if (ok)
+	{
 	    loaded++;
+	}
+	else
+	{
+	    for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
+	    {
+		if (cfs->filtersFunctions[target][i])
+		    destroyFragmentFunction (s, cfs->filtersFunctions[target][i]);
+		cfs->filtersFunctions[target][i] = 0;
+	    }
+	}
+    }
+
+    /* Fuse successfully loaded filters for the cumulative mode */
+    files = malloc (sizeof (char *) * count);
+    if (files)
+    {
+	nFiles = 0;
+	for (i = 0; i < count; i++)
+	    if (cfs->filtersFunctions[COMP_FETCH_TARGET_2D][i])
+		files[nFiles++] = filters->value[i].s;
+
+	for (target = 0; target < COMP_FETCH_TARGET_NUM && nFiles; target++)
+	{
+	    cfs->cumulativeFunctions[target] = malloc (sizeof (int) * nFiles);
+	    if (!cfs->cumulativeFunctions[target])
+		continue;
+
+	    cfs->cumulativeCount[target] =
+		loadFusedFragmentPrograms (files, nFiles, s, target,
+					   cfs->cumulativeFunctions[target]);
+	}
+	free (files);
     }
 
     /* Warn if there was at least one loading failure */
@@ -422,16 +541,14 @@ static void
 colorFilterDrawWindowTexture (CompWindow *w, CompTexture *texture,
 			      const FragmentAttrib *attrib, unsigned int mask)
 {
-    int i, function;
+    int i, function, target;
+    int *functions;
 
     FILTER_SCREEN (w->screen);
     FILTER_WINDOW (w);
 
-    /* Check if filters have to be loaded and load them if so
-     * Maybe should this check be done only if a filter is going to be applied
-     * for this texture? */
-    if (!cfs->filtersLoaded)
-	loadFilters (w->screen, texture);    
+    if (!cfs->filtersLoaded && cfw->isFiltered)
+	loadFilters (w->screen);
 
     /* Filter texture if :
      *   o GL_ARB_fragment_program available
@@ -444,22 +561,27 @@ colorFilterDrawWindowTexture (CompWindow *w, CompTexture *texture,
 	 (texture->name == w->texture->name)))
     {
 	FragmentAttrib fa = *attrib;
+
+	/* Pick the filters built for this texture's target */
+	if (texture->target == GL_TEXTURE_2D)
+	    target = COMP_FETCH_TARGET_2D;
+	else
+	    target = COMP_FETCH_TARGET_RECT;
+
+	functions = cfs->filtersFunctions[target];
+
 	if (cfs->currentFilter == 0) /* Cumulative filters mode */
 	{
-	    /* Enable each filter one by one */
-	    for (i = 0; i < cfs->filtersCount; i++)
-	    {
-		function = cfs->filtersFunctions[i];
-		if (function)
-		    addFragmentFunction (&fa, function);
-	    }
+	    /* Enable the fused filters, which usually is a single function */
+	    for (i = 0; i < cfs->cumulativeCount[target]; i++)
+		addFragmentFunction (&fa, cfs->cumulativeFunctions[target][i]);
 	}
 	/* Single filter mode */
 	else if (cfs->currentFilter <= cfs->filtersCount)
 	{
 	    /* Enable the currently selected filter if possible (i.e. if it
 	     * was successfully loaded) */
-	    function = cfs->filtersFunctions[cfs->currentFilter - 1];
+	    function = functions[cfs->currentFilter - 1];
 	    if (function)
 		addFragmentFunction (&fa, function);
 	}
@@ -486,59 +608,182 @@ colorFilterWindowAdd (CompScreen *s,
 
     /* cfw->isFiltered is initialized to FALSE in InitWindow, so we only
        have to toggle it to TRUE if necessary */
-    if (cfs->isFiltered && matchEval (colorfilterGetFilterMatch (s), w))
+    if (cfs->isFiltered && colorFilterWindowIsMatched (w))
 	colorFilterToggleWindow (w);
 }
 
 /* Internal stuff ----------------------------------------------------------- */
 
 /*
- * Filtering match settings update callback
+ * Re-check a window against new match results
  */
 static void
-colorFilterMatchsChanged (CompScreen *s, CompOption *opt,
-			  ColorfilterScreenOptions num)
+colorFilterApplyMatchUpdate (CompWindow *w)
+{
+    FILTER_SCREEN (w->screen);
+    FILTER_WINDOW (w);
+
+    if (cfw->matchUpdate & MATCH_UPDATE_FILTER)
+    {
+	if (colorFilterWindowIsMatched (w) &&
+	    cfs->isFiltered && !cfw->isFiltered)
+	{
+	    colorFilterToggleWindow (w);
+	}
+    }
+
+    if (cfw->matchUpdate & MATCH_UPDATE_EXCLUDE)
+    {
+	Bool isExcluded = colorFilterWindowIsExcluded (w);
+
+	if (isExcluded && cfw->isFiltered)
+	    colorFilterToggleWindow (w);
+	else if (!isExcluded && cfs->isFiltered && !cfw->isFiltered)
+	    colorFilterToggleWindow (w);
+    }
+
+    cfw->matchUpdate = 0;
+}
+
+/*
+ * Update a batch of windows after a match settings change, then let
+ * events be processed before the next batch
+ */
+static Bool
+colorFilterMatchUpdateTimeout (void *closure)
 {
+    CompScreen *s = closure;
     CompWindow *w;
+    int        count = 0;
 
     FILTER_SCREEN (s);
 
-    /* Re-check every window against new match settings */
     for (w = s->windows; w; w = w->next)
     {
 	FILTER_WINDOW (w);
-	if (matchEval (colorfilterGetFilterMatch (s), w) &&
-	    cfs->isFiltered && !cfw->isFiltered)
-	{
-	    colorFilterToggleWindow (w);
-	}
+
+	if (!cfw->matchUpdate)
+	    continue;
+
+	if (count++ == MATCH_UPDATE_BATCH_SIZE)
+	    return TRUE;
+
+	colorFilterApplyMatchUpdate (w);
     }
+
+    cfs->matchUpdateHandle = 0;
+
+    return FALSE;
 }
 
 /*
- * Exclude match settings update callback
+ * Invalidate match results of every window and schedule their update
  */
 static void
-colorFilterExcludeMatchsChanged (CompScreen *s, CompOption *opt,
-				 ColorfilterScreenOptions num)
+colorFilterScheduleMatchUpdate (CompScreen *s, unsigned int update)
 {
     CompWindow *w;
 
     FILTER_SCREEN (s);
 
-    /* Re-check every window against new match settings */
     for (w = s->windows; w; w = w->next)
     {
-	Bool isExcluded;
+	FILTER_WINDOW (w);
+
+	cfw->matchesValid = FALSE;
+	cfw->matchUpdate |= update;
+    }
+
+    if (update && !cfs->matchUpdateHandle)
+	cfs->matchUpdateHandle =
+	    compAddTimeout (0, 0, colorFilterMatchUpdateTimeout, s);
+}
+
+/*
+ * Filtering match settings update callback
+ */
+static void
+colorFilterMatchsChanged (CompScreen *s, CompOption *opt,
+			  ColorfilterScreenOptions num)
+{
+    /* Re-check every window against new match settings */
+    colorFilterScheduleMatchUpdate (s, MATCH_UPDATE_FILTER);
+}
 
+/*
+ * Exclude match settings update callback
+ */
+static void
+colorFilterExcludeMatchsChanged (CompScreen *s, CompOption *opt,
+				 ColorfilterScreenOptions num)
+{
+    /* Re-check every window against new match settings */
+    colorFilterScheduleMatchUpdate (s, MATCH_UPDATE_EXCLUDE);
+}
+
+/*
+ * Re-check a window when properties used by matches changed
+ */
+static void
+colorFilterMatchPropertyChanged (CompDisplay *d,
+				 CompWindow  *w)
+{
+    FILTER_DISPLAY (d);
+
+    if (w->screen->fragmentProgram)
+    {
+	FILTER_SCREEN (w->screen);
 	FILTER_WINDOW (w);
 
-	isExcluded = matchEval (colorfilterGetExcludeMatch (s), w);
-	if (isExcluded && cfw->isFiltered)
-	    colorFilterToggleWindow (w);
-	else if (!isExcluded && cfs->isFiltered && !cfw->isFiltered)
-	    colorFilterToggleWindow (w);
+	/* results that are out of date already are handled by the
+	   match update timeout */
+	if (cfw->matchesValid)
+	{
+	    Bool filterMatched  = cfw->filterMatched;
+	    Bool excludeMatched = cfw->excludeMatched;
+
+	    cfw->matchesValid = FALSE;
+	    colorFilterUpdateMatches (w);
+
+	    /* only follow results that changed, so that windows toggled
+	       by hand keep their state */
+	    if (cfw->excludeMatched && !excludeMatched)
+	    {
+		if (cfw->isFiltered)
+		    colorFilterToggleWindow (w);
+	    }
+	    else if (cfw->filterMatched && !cfw->excludeMatched &&
+		     (!filterMatched || excludeMatched) &&
+		     cfs->isFiltered && !cfw->isFiltered)
+	    {
+		colorFilterToggleWindow (w);
+	    }
+	}
     }
+
+    UNWRAP (cfd, d, matchPropertyChanged);
+    (*d->matchPropertyChanged) (d, w);
+    WRAP (cfd, d, matchPropertyChanged, colorFilterMatchPropertyChanged);
+}
+
+/*
+ * Match results may change when a match expression handler is added
+ * or removed
+ */
+static void
+colorFilterMatchExpHandlerChanged (CompDisplay *d)
+{
+    CompScreen *s;
+
+    FILTER_DISPLAY (d);
+
+    UNWRAP (cfd, d, matchExpHandlerChanged);
+    (*d->matchExpHandlerChanged) (d);
+    WRAP (cfd, d, matchExpHandlerChanged, colorFilterMatchExpHandlerChanged);
+
+    for (s = d->screens; s; s = s->next)
+	if (s->fragmentProgram)
+	    colorFilterScheduleMatchUpdate (s, 0);
 }
 
 /*
@@ -549,9 +794,12 @@ colorFiltersChanged (CompScreen *s, CompOption *opt,
 		     ColorfilterScreenOptions num)
 {
     FILTER_SCREEN (s);
-    /* Just set the filtersLoaded boolean to FALSE, unloadFilters will be
-     * called in loadFilters */
-    cfs->filtersLoaded = FALSE;
+
+    /* Rebuild filters for every target right away if they were in use,
+     * otherwise leave it to the first filtered painting.  unloadFilters
+     * will be called in loadFilters */
+    if (cfs->filtersLoaded)
+	loadFilters (s);
 }
 
 /*
@@ -691,6 +939,9 @@ colorFilterInitDisplay (CompPlugin * p, CompDisplay * d)
 	return FALSE;
     }
 
+    WRAP (cfd, d, matchPropertyChanged, colorFilterMatchPropertyChanged);
+    WRAP (cfd, d, matchExpHandlerChanged, colorFilterMatchExpHandlerChanged);
+
     colorfilterSetToggleWindowKeyInitiate (d, colorFilterToggle);
     colorfilterSetToggleScreenKeyInitiate (d, colorFilterToggleAll);
     colorfilterSetSwitchFilterKeyInitiate (d, colorFilterSwitch);
@@ -712,6 +963,8 @@ colorFilterFiniDisplay (CompPlugin * p, CompDisplay * d)
 {
     FILTER_DISPLAY (d);
     freeScreenPrivateIndex (d, cfd->screenPrivateIndex);
+    UNWRAP (cfd, d, matchPropertyChanged);
+    UNWRAP (cfd, d, matchExpHandlerChanged);
     free (cfd);
 }
 
@@ -719,6 +972,7 @@ static Bool
 colorFilterInitScreen (CompPlugin * p, CompScreen * s)
 {
     ColorFilterScreen *cfs;
+    int i;
 
     FILTER_DISPLAY (s->display);
 
@@ -743,10 +997,17 @@ colorFilterInitScreen (CompPlugin * p, CompScreen * s)
     cfs->isFiltered = FALSE;
     cfs->currentFilter = 0;
 
+    for (i = 0; i < COMP_FETCH_TARGET_NUM; i++)
+    {
+	cfs->filtersFunctions[i] = NULL;
+	cfs->cumulativeFunctions[i] = NULL;
+	cfs->cumulativeCount[i] = 0;
+    }
     cfs->filtersLoaded = FALSE;
-    cfs->filtersFunctions = NULL;
     cfs->filtersCount = 0;
 
+    cfs->matchUpdateHandle = 0;
+
 #ifdef HAVE_LIBNOTIFY
     cfs->notification = NULL;
     if (notify_is_initted ())
@@ -790,6 +1051,9 @@ colorFilterFiniScreen (CompPlugin * p, CompScreen * s)
     freeWindowPrivateIndex (s, cfs->windowPrivateIndex);
     UNWRAP (cfs, s, drawWindowTexture);
 
+    if (cfs->matchUpdateHandle)
+	compRemoveTimeout (cfs->matchUpdateHandle);
+
     unloadFilters (s);
 
 #ifdef HAVE_LIBNOTIFY
@@ -816,6 +1080,11 @@ colorFilterInitWindow (CompPlugin * p, CompWindow * w)
 
     cfw->isFiltered = FALSE;
 
+    cfw->matchesValid = FALSE;
+    cfw->filterMatched = FALSE;
+    cfw->excludeMatched = FALSE;
+    cfw->matchUpdate = 0;
+
     w->base.privates[cfs->windowPrivateIndex].ptr = cfw;
 
     return TRUE;
@@ -872,6 +1141,7 @@ colorFilterInit (CompPlugin * p)
 static void
 colorFilterFini (CompPlugin * p)
 {
+    freeFragmentProgramCache ();
     freeCorePrivateIndex (corePrivateIndex);
 }
 
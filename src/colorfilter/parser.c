@@ -26,10 +26,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <locale.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include <compiz-core.h>
 #include "parser.h"
 
+/* Parsed programs, shared by every screen and kept until the plugin is
+ * unloaded so that reloading the filters list does not hit the disk */
+static FilterProgram *programCache = NULL;
+
 /* Internal prototypes ------------------------------------------------------ */
 
 static char *
@@ -106,38 +113,50 @@ programCleanName (char *name)
 }
 
 /*
- * File reader function
+ * Find the file a filter name refers to, returns a malloc'ed path
  */
 static char *
-programReadSource (char *fname)
+programFindSource (char *fname, struct stat *st)
 {
-    FILE   *fp;
-    char   *data, *path = NULL, *home = getenv ("HOME");
-    int     length;
+    char   *path = NULL, *home = getenv ("HOME");
 
-    /* Try to open file fname as is */
-    fp = fopen (fname, "r");
+    /* Try to use file fname as is */
+    if (stat (fname, st) == 0 && S_ISREG (st->st_mode))
+	return strdup (fname);
 
     /* If failed, try as user filter file (in ~/.compiz/data/filters) */
-    if (!fp && home && strlen (home))
+    if (home && strlen (home))
     {
 	if (asprintf (&path, "%s/.compiz/data/filters/%s", home, fname) == -1)
 		return NULL;
-	fp = fopen (path, "r");
+	if (stat (path, st) == 0 && S_ISREG (st->st_mode))
+	    return path;
 	free (path);
     }
 
     /* If failed again, try as system wide data file 
      * (in PREFIX/share/compiz/filters) */
-    if (!fp)
-    {
-	if (asprintf (&path, "%s/filters/%s", DATADIR, fname) == -1)
-		return NULL;
-	fp = fopen (path, "r");
-	free (path);
-    }
+    if (asprintf (&path, "%s/filters/%s", DATADIR, fname) == -1)
+	return NULL;
+    if (stat (path, st) == 0 && S_ISREG (st->st_mode))
+	return path;
+    free (path);
 
     /* If failed again & again, abort */
+    return NULL;
+}
+
+/*
+ * File reader function
+ */
+static char *
+programReadSource (char *path)
+{
+    FILE   *fp;
+    char   *data;
+    int     length;
+
+    fp = fopen (path, "r");
     if (!fp)
 	return NULL;
 
@@ -324,15 +343,962 @@ programFreeOffset (FragmentOffset *offset)
     free (offset);
 }
 
+/* Parsed program related functions ----------------------------------------- */
+
+/*
+ * Append an op to a parsed program
+ */
+static Bool
+programAddOp (FilterProgram *program, int type, char *arg1, char *arg2)
+{
+    FilterOp *ops, *op;
+
+    ops = realloc (program->ops, sizeof (FilterOp) * (program->nOps + 1));
+    if (!ops)
+	return FALSE;
+    program->ops = ops;
+
+    op = &ops[program->nOps];
+    op->type = type;
+    op->arg1 = strdup (arg1);
+    op->arg2 = arg2 ? strdup (arg2) : NULL;
+    if (!op->arg1 || (arg2 && !op->arg2))
+    {
+	free (op->arg1);
+	free (op->arg2);
+	return FALSE;
+    }
+
+    program->nOps++;
+
+    return TRUE;
+}
+
+/*
+ * Free the ops of a parsed program
+ */
+static void
+programFreeOps (FilterProgram *program)
+{
+    int i;
+
+    for (i = 0; i < program->nOps; i++)
+    {
+	free (program->ops[i].arg1);
+	free (program->ops[i].arg2);
+    }
+
+    free (program->ops);
+    program->ops = NULL;
+    program->nOps = 0;
+}
+
+/*
+ * Free a parsed program
+ */
+static void
+programFree (FilterProgram *program)
+{
+    programFreeOps (program);
+    free (program->path);
+    free (program);
+}
+
+/*
+ * Add the ops of a parsed program to function data, using the given
+ * texture target for fetch ops
+ */
+static Bool
+programAddToFunctionData (CompFunctionData *data,
+			  FilterProgram *program, int target)
+{
+    FilterOp *op;
+    Bool     ok = TRUE;
+    int      i;
+
+    for (i = 0; i < program->nOps; i++)
+    {
+	op = &program->ops[i];
+
+	switch (op->type)
+	{
+	    case DataOp:
+		ok &= addDataOpToFunctionData (data, op->arg1);
+		break;
+	    case TempOp:
+		ok &= addTempHeaderOpToFunctionData (data, op->arg1);
+		break;
+	    case ParamOp:
+		ok &= addParamHeaderOpToFunctionData (data, op->arg1);
+		break;
+	    case AttribOp:
+		ok &= addAttribHeaderOpToFunctionData (data, op->arg1);
+		break;
+	    case FetchOp:
+		ok &= addFetchOpToFunctionData (data, op->arg1, op->arg2,
+						target);
+		break;
+	    case ColorOp:
+		ok &= addColorOpToFunctionData (data, op->arg1, op->arg2);
+		break;
+	    default:
+		break;
+	}
+    }
+
+    return ok;
+}
+
+/* Filters fusion related functions ----------------------------------------- */
+
+/*
+ * Check if an identifier is declared by a TEMP, PARAM or ATTRIB op
+ * of a parsed program
+ */
+static Bool
+programIsDeclared (FilterProgram *program, const char *name, int length)
+{
+    FilterOp *op;
+    int      i;
+
+    for (i = 0; i < program->nOps; i++)
+    {
+	op = &program->ops[i];
+	if (op->type != TempOp && op->type != ParamOp && op->type != AttribOp)
+	    continue;
+
+	if (strncmp (op->arg1, name, length) == 0 &&
+	    !isalnum (op->arg1[length]) && op->arg1[length] != '_')
+	    return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Prefix every identifier declared by a program in an op argument,
+ * so that several programs can live in the same function.
+ * Returns a malloc'ed string.
+ */
+static char *
+programRenameIdentifiers (FilterProgram *program, const char *arg,
+			  const char *prefix)
+{
+    const char *current = arg, *start;
+    char       *dest, *result;
+    int        prefixLength = strlen (prefix);
+
+    result = dest = malloc (strlen (arg) * (prefixLength + 1) + 1);
+    if (!result)
+	return NULL;
+
+    while (*current)
+    {
+	start = current;
+	if (isalpha (*current) || *current == '_')
+	{
+	    while (isalnum (*current) || *current == '_')
+		current++;
+
+	    /* Don't touch swizzles and members (e.g. "temp.x") */
+	    if ((start == arg || start[-1] != '.') &&
+		programIsDeclared (program, start, current - start))
+	    {
+		memcpy (dest, prefix, prefixLength);
+		dest += prefixLength;
+	    }
+	}
+	else if (isdigit (*current))
+	{
+	    /* Skip whole numbers, e.g. "1e5" */
+	    while (isalnum (*current) || *current == '.')
+		current++;
+	}
+	else
+	    current++;
+
+	memcpy (dest, start, current - start);
+	dest += current - start;
+    }
+    *dest = 0;
+
+    return result;
+}
+
+/*
+ * Check if an op writes to the "output" temporary
+ */
+static Bool
+programOpWritesOutput (FilterOp *op)
+{
+    const char *dst;
+
+    if (op->type == ColorOp)
+	return strcmp (op->arg1, "output") == 0;
+
+    if (op->type != DataOp)
+	return FALSE;
+
+    /* Skip the instruction name, the destination comes right after */
+    dst = op->arg1;
+    while (*dst && *dst != ' ' && *dst != '\t')
+	dst++;
+    dst = ltrim ((char *) dst);
+
+    return strncmp (dst, "output", 6) == 0 &&
+	   !isalnum (dst[6]) && dst[6] != '_';
+}
+
+/*
+ * Check if a program can be fused after another one : each of its texture
+ * fetches then reads the output of the previous program instead of the
+ * texture. This is not possible for fetches with an offset since the
+ * previous programs would have to run at another texel, or if "output"
+ * is overwritten before the last fetch.
+ */
+static Bool
+programCanFuse (FilterProgram *program)
+{
+    int  i, lastFetch = -1;
+
+    for (i = 0; i < program->nOps; i++)
+    {
+	if (program->ops[i].type != FetchOp)
+	    continue;
+
+	if (program->ops[i].arg2)
+	    return FALSE;
+
+	lastFetch = i;
+    }
+
+    for (i = 0; i < lastFetch; i++)
+    {
+	if (programOpWritesOutput (&program->ops[i]))
+	    return FALSE;
+    }
+
+    return TRUE;
+}
+
+/*
+ * Add the ops of a parsed program to function data already containing
+ * index other programs. Declared identifiers are prefixed to avoid
+ * clashes, and unless the program is the first one, fetches and color ops
+ * are replaced by moves from the previous program output.
+ */
+static Bool
+programAddFusedToFunctionData (CompFunctionData *data,
+			       FilterProgram *program, int target,
+			       int index, Bool *colorDone)
+{
+    FilterOp *op;
+    char     prefix[16];
+    char     *arg1, *arg2;
+    Bool     ok = TRUE;
+    int      i;
+
+    snprintf (prefix, sizeof (prefix), "f%d_", index);
+
+    for (i = 0; i < program->nOps && ok; i++)
+    {
+	op = &program->ops[i];
+
+	arg1 = programRenameIdentifiers (program, op->arg1, prefix);
+	arg2 = NULL;
+	if (op->arg2)
+	    arg2 = programRenameIdentifiers (program, op->arg2, prefix);
+	if (!arg1 || (op->arg2 && !arg2))
+	{
+	    free (arg1);
+	    free (arg2);
+	    return FALSE;
+	}
+
+	switch (op->type)
+	{
+	    case DataOp:
+		ok &= addDataOpToFunctionData (data, "%s", arg1);
+		break;
+	    case TempOp:
+		ok &= addTempHeaderOpToFunctionData (data, arg1);
+		break;
+	    case ParamOp:
+		ok &= addParamHeaderOpToFunctionData (data, arg1);
+		break;
+	    case AttribOp:
+		ok &= addAttribHeaderOpToFunctionData (data, arg1);
+		break;
+	    case FetchOp:
+		if (!index)
+		    ok &= addFetchOpToFunctionData (data, arg1, arg2, target);
+		else if (strcmp (arg1, "output") != 0)
+		    ok &= addDataOpToFunctionData (data, "MOV %s, output;",
+						   arg1);
+		break;
+	    case ColorOp:
+		/* The fragment color is only applied once, by the first
+		 * color op, like when chaining functions */
+		if (!*colorDone)
+		    ok &= addColorOpToFunctionData (data, arg1, arg2);
+		else if (strcmp (arg1, arg2) != 0)
+		    ok &= addDataOpToFunctionData (data, "MOV %s, %s;",
+						   arg1, arg2);
+		break;
+	    default:
+		break;
+	}
+
+	if (op->type == ColorOp)
+	    *colorDone = TRUE;
+
+	free (arg1);
+	free (arg2);
+    }
+
+    return ok;
+}
+
+/* Color matrix related functions ------------------------------------------ */
+
+/* Symbolic value of a register while evaluating a program : each channel is
+ * an affine transform of the fetched texel, if known */
+typedef struct _MatrixValue
+{
+    ColorMatrix value;
+    Bool	valid[4];
+} MatrixValue;
+
+typedef struct _MatrixRegister
+{
+    const char  *name;
+    int		length;
+    Bool	constant;
+    MatrixValue value;
+} MatrixRegister;
+
+/*
+ * Numbers have to be read and written the same way whatever the user
+ * locale is, since they are part of ARB programs
+ */
+static locale_t
+matrixUseCLocale (locale_t *previous)
+{
+    locale_t locale;
+
+    locale = newlocale (LC_NUMERIC_MASK, "C", (locale_t) 0);
+    if (locale)
+	*previous = uselocale (locale);
+
+    return locale;
+}
+
+static void
+matrixRestoreLocale (locale_t locale, locale_t previous)
+{
+    if (!locale)
+	return;
+
+    uselocale (previous);
+    freelocale (locale);
+}
+
+/*
+ * Check if a channel does not depend on the texel
+ */
+static Bool
+matrixRowIsConstant (const double *row)
+{
+    return !row[0] && !row[1] && !row[2] && !row[3];
+}
+
+/*
+ * Multiply two channels, one of them has to be constant
+ */
+static Bool
+matrixMultiplyRows (double *dest, const double *a, const double *b)
+{
+    double factor;
+    int   i;
+
+    if (matrixRowIsConstant (a))
+	factor = a[4];
+    else if (matrixRowIsConstant (b))
+    {
+	factor = b[4];
+	b = a;
+    }
+    else
+	return FALSE;
+
+    for (i = 0; i < 5; i++)
+	dest[i] = factor * b[i];
+
+    return TRUE;
+}
+
+/*
+ * Compose two color matrices : result applies b then a
+ */
+static void
+matrixCompose (ColorMatrix *result, const ColorMatrix *a, const ColorMatrix *b)
+{
+    ColorMatrix m;
+    int         i, j, k;
+
+    for (i = 0; i < 4; i++)
+    {
+	for (j = 0; j < 5; j++)
+	{
+	    m.m[i][j] = (j == 4) ? a->m[i][4] : 0;
+	    for (k = 0; k < 4; k++)
+		m.m[i][j] += a->m[i][k] * b->m[k][j];
+	}
+    }
+
+    *result = m;
+}
+
+/*
+ * Get the channel index of a swizzle or mask character
+ */
+static int
+matrixComponent (char c)
+{
+    switch (c)
+    {
+	case 'x': case 'r': return 0;
+	case 'y': case 'g': return 1;
+	case 'z': case 'b': return 2;
+	case 'w': case 'a': return 3;
+	default: return -1;
+    }
+}
+
+/*
+ * Check that only blanks are left in a string
+ */
+static Bool
+matrixIsEnd (const char *str)
+{
+    return !*ltrim ((char *) str);
+}
+
+/*
+ * Parse a constant, either a scalar or a vector like "{1, 0, 0.5}"
+ */
+static Bool
+matrixParseConstant (const char **str, double *v)
+{
+    const char *current = *str;
+    char       *end;
+    int        i;
+
+    if (*current != '{')
+    {
+	v[0] = strtod (current, &end);
+	if (end == current)
+	    return FALSE;
+	v[1] = v[2] = v[3] = v[0];
+	*str = end;
+	return TRUE;
+    }
+
+    /* Missing components default to (0, 0, 1) */
+    v[0] = v[1] = v[2] = 0;
+    v[3] = 1;
+
+    current++;
+    for (i = 0; i < 4; i++)
+    {
+	v[i] = strtod (current, &end);
+	if (end == current)
+	    return FALSE;
+	current = ltrim (end);
+	if (*current != ',')
+	    break;
+	current++;
+    }
+
+    if (*current != '}')
+	return FALSE;
+
+    *str = current + 1;
+
+    return TRUE;
+}
+
+/*
+ * Find a register by name
+ */
+static MatrixRegister *
+matrixFindRegister (MatrixRegister *regs, int nRegs,
+		    const char *name, int length)
+{
+    int i;
+
+    for (i = 0; i < nRegs; i++)
+    {
+	if (regs[i].length == length &&
+	    strncmp (regs[i].name, name, length) == 0)
+	    return &regs[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Get the symbolic value of a source operand,
+ * e.g. "-temp.rrra" or "{1, 0, 0, 0}.r"
+ */
+static Bool
+matrixGetOperand (MatrixRegister *regs, int nRegs,
+		  const char *arg, MatrixValue *result)
+{
+    MatrixRegister *reg;
+    MatrixValue    value;
+    const char     *start;
+    double          v[4];
+    int            i, j, swizzle[4];
+    Bool           negate = FALSE;
+
+    arg = ltrim ((char *) arg);
+    if (*arg == '-')
+    {
+	negate = TRUE;
+	arg = ltrim ((char *) arg + 1);
+    }
+
+    if (*arg == '{' || isdigit (*arg) || *arg == '.')
+    {
+	if (!matrixParseConstant (&arg, v))
+	    return FALSE;
+
+	memset (&value, 0, sizeof (MatrixValue));
+	for (i = 0; i < 4; i++)
+	{
+	    value.value.m[i][4] = v[i];
+	    value.valid[i] = TRUE;
+	}
+    }
+    else if (isalpha (*arg) || *arg == '_')
+    {
+	start = arg;
+	while (isalnum (*arg) || *arg == '_')
+	    arg++;
+
+	reg = matrixFindRegister (regs, nRegs, start, arg - start);
+	if (!reg)
+	    return FALSE;
+
+	value = reg->value;
+    }
+    else
+	return FALSE;
+
+    *result = value;
+
+    /* Swizzle, one component is replicated */
+    if (*arg == '.')
+    {
+	arg++;
+	for (i = 0; i < 4 && matrixComponent (arg[i]) >= 0; i++)
+	    swizzle[i] = matrixComponent (arg[i]);
+
+	if (i == 1)
+	    swizzle[1] = swizzle[2] = swizzle[3] = swizzle[0];
+	else if (i != 4)
+	    return FALSE;
+
+	arg += i;
+
+	for (i = 0; i < 4; i++)
+	{
+	    memcpy (result->value.m[i], value.value.m[swizzle[i]],
+		    sizeof (double) * 5);
+	    result->valid[i] = value.valid[swizzle[i]];
+	}
+    }
+
+    if (!matrixIsEnd (arg))
+	return FALSE;
+
+    if (negate)
+	for (i = 0; i < 4; i++)
+	    for (j = 0; j < 5; j++)
+		result->value.m[i][j] = -result->value.m[i][j];
+
+    return TRUE;
+}
+
+/*
+ * Get the register and write mask of a destination operand, e.g. "temp.rgb"
+ */
+static Bool
+matrixGetDestination (MatrixRegister *regs, int nRegs, const char *arg,
+		      MatrixRegister **reg, Bool *mask)
+{
+    const char *start;
+    int        i, c;
+
+    arg = ltrim ((char *) arg);
+    start = arg;
+    while (isalnum (*arg) || *arg == '_')
+	arg++;
+
+    *reg = matrixFindRegister (regs, nRegs, start, arg - start);
+    if (!*reg || (*reg)->constant)
+	return FALSE;
+
+    for (i = 0; i < 4; i++)
+	mask[i] = (*arg != '.');
+
+    if (*arg == '.')
+    {
+	for (arg++; (c = matrixComponent (*arg)) >= 0; arg++)
+	    mask[c] = TRUE;
+    }
+
+    return matrixIsEnd (arg);
+}
+
+/*
+ * Split instruction operands on commas, except those in constant vectors
+ */
+static int
+matrixSplitOperands (char *str, char **argv, int max)
+{
+    int argc = 0, depth = 0;
+
+    argv[argc++] = str;
+    for (; *str; str++)
+    {
+	if (*str == '{')
+	    depth++;
+	else if (*str == '}')
+	    depth--;
+	else if (*str == ',' && !depth)
+	{
+	    if (argc == max)
+		return -1;
+	    *str = 0;
+	    argv[argc++] = str + 1;
+	}
+    }
+
+    return argc;
+}
+
+/*
+ * Symbolically run a data op
+ */
+static Bool
+matrixEvalDataOp (MatrixRegister *regs, int nRegs, const char *op)
+{
+    MatrixRegister *dst;
+    MatrixValue    src[3], result;
+    char           *instruction, *args, *argv[4];
+    int            argc, i, j, n, nSrc;
+    Bool           mask[4], ok = FALSE;
+
+    instruction = strdup (op);
+    if (!instruction)
+	return FALSE;
+
+    /* Strip the terminating semicolon and isolate the instruction name,
+     * saturated or other variants are not affine */
+    if ((args = strchr (instruction, ';')))
+	*args = 0;
+    for (args = instruction; *args && !isspace (*args); args++)
+	if (*args == '_')
+	    goto out;
+    if (!*args)
+	goto out;
+    *args++ = 0;
+
+    argc = matrixSplitOperands (args, argv, 4);
+    if (argc < 2 || !matrixGetDestination (regs, nRegs, argv[0], &dst, mask))
+	goto out;
+
+    nSrc = argc - 1;
+    for (i = 0; i < nSrc; i++)
+	if (!matrixGetOperand (regs, nRegs, argv[i + 1], &src[i]))
+	    goto out;
+
+    memset (&result, 0, sizeof (MatrixValue));
+
+    if (!strcmp (instruction, "DP3") || !strcmp (instruction, "DP4"))
+    {
+	if (nSrc != 2)
+	    goto out;
+
+	n = instruction[2] - '0';
+	for (i = 0; i < n; i++)
+	{
+	    double product[5];
+
+	    if (!src[0].valid[i] || !src[1].valid[i] ||
+		!matrixMultiplyRows (product, src[0].value.m[i],
+				     src[1].value.m[i]))
+		goto out;
+
+	    for (j = 0; j < 5; j++)
+		result.value.m[0][j] += product[j];
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+	    memcpy (result.value.m[i], result.value.m[0], sizeof (double) * 5);
+	    result.valid[i] = TRUE;
+	}
+    }
+    else
+    {
+	for (i = 0; i < 4; i++)
+	{
+	    double *row = result.value.m[i];
+
+	    if (!mask[i])
+		continue;
+
+	    for (j = 0; j < nSrc; j++)
+		if (!src[j].valid[i])
+		    goto out;
+
+	    if (!strcmp (instruction, "MOV") && nSrc == 1)
+		memcpy (row, src[0].value.m[i], sizeof (double) * 5);
+	    else if (!strcmp (instruction, "ADD") && nSrc == 2)
+		for (j = 0; j < 5; j++)
+		    row[j] = src[0].value.m[i][j] + src[1].value.m[i][j];
+	    else if (!strcmp (instruction, "SUB") && nSrc == 2)
+		for (j = 0; j < 5; j++)
+		    row[j] = src[0].value.m[i][j] - src[1].value.m[i][j];
+	    else if (!strcmp (instruction, "MUL") && nSrc == 2)
+	    {
+		if (!matrixMultiplyRows (row, src[0].value.m[i],
+					 src[1].value.m[i]))
+		    goto out;
+	    }
+	    else if (!strcmp (instruction, "MAD") && nSrc == 3)
+	    {
+		if (!matrixMultiplyRows (row, src[0].value.m[i],
+					 src[1].value.m[i]))
+		    goto out;
+		for (j = 0; j < 5; j++)
+		    row[j] += src[2].value.m[i][j];
+	    }
+	    else
+		goto out;
+
+	    result.valid[i] = TRUE;
+	}
+    }
+
+    /* Write the result according to the mask, only now since a source
+     * can also be the destination */
+    for (i = 0; i < 4; i++)
+    {
+	if (!mask[i])
+	    continue;
+
+	memcpy (dst->value.value.m[i], result.value.m[i], sizeof (double) * 5);
+	dst->value.valid[i] = TRUE;
+    }
+
+    ok = TRUE;
+
+out:
+    free (instruction);
+    return ok;
+}
+
+/*
+ * Add a register for a TEMP or PARAM header op
+ */
+static void
+matrixAddRegister (MatrixRegister *reg, const char *decl, Bool constant)
+{
+    const char *value;
+    double      v[4];
+    int        i;
+
+    memset (reg, 0, sizeof (MatrixRegister));
+
+    reg->name = ltrim ((char *) decl);
+    while (isalnum (reg->name[reg->length]) || reg->name[reg->length] == '_')
+	reg->length++;
+    reg->constant = constant;
+
+    /* Only constant vectors are supported as parameters */
+    if (!constant || !(value = strchr (decl, '=')))
+	return;
+
+    value = ltrim ((char *) value + 1);
+    if (!matrixParseConstant (&value, v) || !matrixIsEnd (value))
+	return;
+
+    for (i = 0; i < 4; i++)
+    {
+	reg->value.value.m[i][4] = v[i];
+	reg->value.valid[i] = TRUE;
+    }
+}
+
+/*
+ * Check if a parsed program reduces to an affine color transform of the
+ * fetched texel and get the transform if so
+ */
+static Bool
+programGetMatrix (FilterProgram *program, ColorMatrix *matrix)
+{
+    MatrixRegister *regs, *dst, *output;
+    MatrixValue    value;
+    FilterOp       *op;
+    locale_t       locale, previous = (locale_t) 0;
+    Bool           mask[4], ok = TRUE, color = FALSE;
+    int            i, j, nRegs = 0;
+
+    regs = malloc (sizeof (MatrixRegister) * (program->nOps + 1));
+    if (!regs)
+	return FALSE;
+
+    locale = matrixUseCLocale (&previous);
+
+    matrixAddRegister (&regs[nRegs++], "output", FALSE);
+
+    for (i = 0; i < program->nOps; i++)
+    {
+	op = &program->ops[i];
+	if (op->type == TempOp || op->type == ParamOp)
+	    matrixAddRegister (&regs[nRegs++], op->arg1, op->type == ParamOp);
+    }
+
+    for (i = 0; i < program->nOps && ok; i++)
+    {
+	op = &program->ops[i];
+
+	/* Nothing but declarations can follow the color op */
+	if (color && (op->type == DataOp || op->type == FetchOp ||
+		      op->type == ColorOp))
+	    ok = FALSE;
+	else if (op->type == DataOp)
+	    ok = matrixEvalDataOp (regs, nRegs, op->arg1);
+	else if (op->type == FetchOp)
+	{
+	    /* The fetched texel is the identity transform */
+	    ok = !op->arg2 &&
+		 matrixGetDestination (regs, nRegs, op->arg1, &dst, mask);
+	    for (j = 0; j < 4 && ok; j++)
+	    {
+		if (!mask[j])
+		    continue;
+
+		memset (dst->value.value.m[j], 0, sizeof (double) * 5);
+		dst->value.value.m[j][j] = 1;
+		dst->value.valid[j] = TRUE;
+	    }
+	}
+	else if (op->type == ColorOp)
+	{
+	    color = TRUE;
+	    ok = matrixGetDestination (regs, nRegs, op->arg1, &dst, mask) &&
+		 matrixGetOperand (regs, nRegs, op->arg2, &value);
+	    for (j = 0; j < 4 && ok; j++)
+	    {
+		if (!mask[j])
+		    continue;
+
+		memcpy (dst->value.value.m[j], value.value.m[j],
+			sizeof (double) * 5);
+		dst->value.valid[j] = value.valid[j];
+	    }
+	}
+    }
+
+    output = &regs[0];
+    for (j = 0; j < 4 && ok; j++)
+	ok = output->value.valid[j];
+
+    if (ok && color)
+	*matrix = output->value.value;
+
+    matrixRestoreLocale (locale, previous);
+    free (regs);
+
+    return ok && color;
+}
+
+/*
+ * Add ops applying a color matrix to function data, either to the fetched
+ * texel or to the output of the previous ops
+ */
+static Bool
+programAddMatrixToFunctionData (CompFunctionData *data,
+				ColorMatrix *matrix, int target,
+				int index, Bool fetch, Bool color)
+{
+    const char *component = "xyzw";
+    char       input[16], offset[128], column[128];
+    locale_t   locale, previous = (locale_t) 0;
+    double      *m[4];
+    Bool       ok = TRUE, first = TRUE, hasOffset;
+    int        i, j;
+
+    for (i = 0; i < 4; i++)
+	m[i] = matrix->m[i];
+
+    snprintf (input, sizeof (input), "m%d_in", index);
+    ok &= addTempHeaderOpToFunctionData (data, input);
+
+    if (fetch)
+	ok &= addFetchOpToFunctionData (data, input, NULL, target);
+    else
+	ok &= addDataOpToFunctionData (data, "MOV %s, output;", input);
+
+    locale = matrixUseCLocale (&previous);
+
+    snprintf (offset, sizeof (offset), "{%.9g, %.9g, %.9g, %.9g}",
+	      m[0][4], m[1][4], m[2][4], m[3][4]);
+    hasOffset = m[0][4] || m[1][4] || m[2][4] || m[3][4];
+
+    /* One MAD for each texel channel actually used */
+    for (j = 0; j < 4; j++)
+    {
+	if (!m[0][j] && !m[1][j] && !m[2][j] && !m[3][j])
+	    continue;
+
+	snprintf (column, sizeof (column), "{%.9g, %.9g, %.9g, %.9g}",
+		  m[0][j], m[1][j], m[2][j], m[3][j]);
+
+	if (first && !hasOffset)
+	    ok &= addDataOpToFunctionData (data, "MUL output, %s.%c, %s;",
+					   input, component[j], column);
+	else
+	    ok &= addDataOpToFunctionData (data, "MAD output, %s.%c, %s, %s;",
+					   input, component[j], column,
+					   first ? offset : "output");
+	first = FALSE;
+    }
+
+    if (first)
+	ok &= addDataOpToFunctionData (data, "MOV output, %s;", offset);
+
+    matrixRestoreLocale (locale, previous);
+
+    if (color)
+	ok &= addColorOpToFunctionData (data, "output", "output");
+
+    return ok;
+}
+
 /* Actual parsing/loading functions ----------------------------------------- */
 
 /*
- * Parse the source buffer op by op and add each op to function data
+ * Parse the source buffer op by op and add each op to the parsed program
  */
 /* FIXME : I am more than 200 lines long, I feel so heavy! */
 static void
-programParseSource (CompFunctionData *data,
-		    int target, char *source)
+programParseSource (FilterProgram *program, char *source)
 {
     char *line, *next, *current;
     char *strtok_ptr = NULL;
@@ -430,8 +1396,10 @@ programParseSource (CompFunctionData *data,
 	    /* Data op : just copy paste the whole instruction plus a ";" */
 	    case DataOp:
 		if (asprintf (&arg1, "%s;", current) != -1)
-			addDataOpToFunctionData (data, arg1);
-		free (arg1);
+		{
+			programAddOp (program, DataOp, arg1, NULL);
+			free (arg1);
+		}
 		break;
 	    /* Parse arguments one by one */
 	    case TempOp:
@@ -453,12 +1421,7 @@ programParseSource (CompFunctionData *data,
 			continue;
 		    }
 		    /* Add ops */
-		    if (type == TempOp)
-			addTempHeaderOpToFunctionData (data, arg1);
-		    else if (type == ParamOp)
-			addParamHeaderOpToFunctionData (data, arg1);
-		    else if (type == AttribOp)
-			addAttribHeaderOpToFunctionData (data, arg1);
+		    programAddOp (program, type, arg1, NULL);
 		    free (arg1);
 		}
 		break;
@@ -475,13 +1438,13 @@ programParseSource (CompFunctionData *data,
 			break;
 		    }
 		    if (strcmp (temp, "fragment.texcoord[0]") == 0)
-			addFetchOpToFunctionData (data, arg1, NULL, target);
+			programAddOp (program, FetchOp, arg1, NULL);
 		    else
 		    {
 			arg2 = programFindOffset (offsets, temp); 
 			if (arg2)
 			{
-			    addFetchOpToFunctionData (data, arg1, arg2, target);
+			    programAddOp (program, FetchOp, arg1, arg2);
 			    free (arg2);
 			}
 		    }
@@ -512,7 +1475,7 @@ programParseSource (CompFunctionData *data,
 			break;
 		    }
 
-		    addColorOpToFunctionData (data, arg1, arg2);
+		    programAddOp (program, ColorOp, arg1, arg2);
 		    free (arg1);
 		    free (arg2);
 		}
@@ -523,7 +1486,7 @@ programParseSource (CompFunctionData *data,
 		    current = strstr (current, ",") + 1;
 		    if ((arg1 = getFirstArgument (&current)))
 		    {
-			addColorOpToFunctionData (data, "output", arg1);
+			programAddOp (program, ColorOp, "output", arg1);
 			free (arg1);
 		    }
 		}
@@ -536,30 +1499,135 @@ programParseSource (CompFunctionData *data,
     }
     programFreeOffset (offsets);
     offsets = NULL;
+
+    /* Check if the program can use the color matrix fast path */
+    program->isMatrix = programGetMatrix (program, &program->matrix);
 }
 
 /*
- * Build a Compiz Fragment Function from a source string
+ * Build a Compiz Fragment Function from a parsed program
  */
-int
-buildFragmentProgram (char *source, char *name,
+static int
+programBuildFunction (FilterProgram *program, char *name,
 		      CompScreen *s, int target)
 {
     CompFunctionData *data;
-    int handle;
+    Bool ok;
+    int handle = 0;
     /* Create the function data */
     data = createFunctionData ();
     if (!data)
 	return 0;
-    /* Parse the source and fill the function data */
-    programParseSource (data, target, source);
-    /* Create the function */
-    handle = createFragmentFunction (s, name, data);
+    /* Fill the function data and create the function, programs that are
+     * a color matrix only need a few MADs */
+    if (program->isMatrix)
+	ok = programAddMatrixToFunctionData (data, &program->matrix, target,
+					     0, TRUE, TRUE);
+    else
+	ok = programAddToFunctionData (data, program, target);
+    if (ok)
+	handle = createFragmentFunction (s, name, data);
     /* Clean things */
     destroyFunctionData (data);
     return handle;
 }
 
+/*
+ * Get the parsed program for a filter file, only reading and parsing it
+ * again if it is not cached yet or if it changed on disk
+ */
+static FilterProgram *
+programLookup (char *file)
+{
+    FilterProgram *program, **prev;
+    struct stat   st;
+    char          *path, *source;
+
+    path = programFindSource (file, &st);
+    if (!path)
+	return NULL;
+
+    for (prev = &programCache; *prev; prev = &(*prev)->next)
+    {
+	program = *prev;
+	if (strcmp (program->path, path) != 0)
+	    continue;
+
+	if (program->mtime == st.st_mtime && program->size == st.st_size)
+	{
+	    free (path);
+	    return program;
+	}
+
+	/* Stale entry, drop it */
+	*prev = program->next;
+	programFree (program);
+	break;
+    }
+
+    source = programReadSource (path);
+    if (!source)
+    {
+	free (path);
+	return NULL;
+    }
+
+    program = calloc (1, sizeof (FilterProgram));
+    if (!program)
+    {
+	free (source);
+	free (path);
+	return NULL;
+    }
+
+    program->path = path;
+    program->mtime = st.st_mtime;
+    program->size = st.st_size;
+
+    programParseSource (program, source);
+    free (source);
+
+    program->next = programCache;
+    programCache = program;
+
+    return program;
+}
+
+/*
+ * Free every cached parsed program
+ */
+void
+freeFragmentProgramCache (void)
+{
+    FilterProgram *program;
+
+    while (programCache)
+    {
+	program = programCache;
+	programCache = program->next;
+	programFree (program);
+    }
+}
+
+/*
+ * Build a Compiz Fragment Function from a source string
+ */
+int
+buildFragmentProgram (char *source, char *name,
+		      CompScreen *s, int target)
+{
+    FilterProgram program;
+    int handle;
+
+    memset (&program, 0, sizeof (FilterProgram));
+    /* Parse the source and build the function from it */
+    programParseSource (&program, source);
+    handle = programBuildFunction (&program, name, s, target);
+    /* Clean things */
+    programFreeOps (&program);
+    return handle;
+}
+
 /*
  * Load a source file and build a Compiz Fragment Function from it
  */
@@ -567,20 +1635,118 @@ int
 loadFragmentProgram (char *file, char *name,
 		     CompScreen *s, int target)
 {
-    char *source;
+    FilterProgram *program;
     int handle;
     /* Clean fragment program name */
     name = programCleanName (name);
-    /* Read the source file */
-    source = programReadSource (file);
-    if (!source)
+    /* Get the parsed source file */
+    program = programLookup (file);
+    if (!program)
     {
 	free (name);
 	return 0;
     }
     /* Build the Compiz Fragment Program */
-    handle = buildFragmentProgram (source, name, s, target);
+    handle = programBuildFunction (program, name, s, target);
     free (name);
-    free (source);
     return handle;
 }
+
+/*
+ * Load source files and build Compiz Fragment Functions applying them
+ * one after the other. Consecutive programs are fused into a single
+ * function whenever possible, so that the previous ones don't have to be
+ * run again for each texture fetch, and consecutive color matrices are
+ * collapsed into a single one. Function handles are stored in functions
+ * (that must be able to hold nFiles handles) and the number of created
+ * functions is returned.
+ */
+int
+loadFusedFragmentPrograms (char **files, int nFiles,
+			   CompScreen *s, int target, int *functions)
+{
+    CompFunctionData *data = NULL;
+    FilterProgram    *program;
+    ColorMatrix      matrix;
+    int              i, handle, nFunctions = 0, nFused = 0, matrixIndex = 0;
+    Bool             ok = TRUE, colorDone = FALSE, hasMatrix = FALSE;
+
+    for (i = 0; i <= nFiles; i++)
+    {
+	/* Programs are used right after the lookup since looking up another
+	 * file may drop stale cache entries */
+	program = NULL;
+	if (i < nFiles)
+	{
+	    program = programLookup (files[i]);
+	    if (!program)
+		continue;
+	}
+
+	/* Apply the pending color matrix before anything that isn't one */
+	if (hasMatrix && (!program || !program->isMatrix ||
+			  !programCanFuse (program)))
+	{
+	    ok &= programAddMatrixToFunctionData (data, &matrix, target,
+						  matrixIndex, FALSE,
+						  !colorDone);
+	    colorDone = TRUE;
+	    hasMatrix = FALSE;
+	}
+
+	/* Build the current function if this program can't be added to it */
+	if (data && (!program || !programCanFuse (program)))
+	{
+	    handle = 0;
+	    if (ok)
+		handle = createFragmentFunction (s, "cumulative", data);
+	    if (handle)
+		functions[nFunctions++] = handle;
+	    destroyFunctionData (data);
+	    data = NULL;
+	}
+
+	if (!program)
+	    break;
+
+	if (!data)
+	{
+	    data = createFunctionData ();
+	    if (!data)
+		break;
+	    nFused = 0;
+	    ok = TRUE;
+	    colorDone = FALSE;
+	}
+
+	if (program->isMatrix && !nFused)
+	{
+	    /* First program of the function, apply it to the texel right away
+	     * since the fragment color has to be applied after it */
+	    ok &= programAddMatrixToFunctionData (data, &program->matrix,
+						  target, nFused, TRUE, TRUE);
+	    colorDone = TRUE;
+	}
+	else if (program->isMatrix)
+	{
+	    /* Collapse consecutive matrices */
+	    if (hasMatrix)
+		matrixCompose (&matrix, &program->matrix, &matrix);
+	    else
+	    {
+		matrix = program->matrix;
+		matrixIndex = nFused;
+		hasMatrix = TRUE;
+	    }
+	}
+	else
+	{
+	    ok &= programAddFusedToFunctionData (data, program, target,
+						 nFused, &colorDone);
+	}
+
+	nFused++;
+    }
+
+    return nFunctions;
+}
@@ -46,6 +46,45 @@ struct _FragmentOffset
     FragmentOffset  *next;
 };
 
+/* A parsed filter instruction, replayed into function data for each
+ * texture target :
+ *   DataOp : arg1 is the whole instruction
+ *   TempOp, ParamOp, AttribOp : arg1 is the declared name
+ *   FetchOp : arg1 is the destination, arg2 the offset or NULL
+ *   ColorOp : arg1 is the destination, arg2 the source */
+typedef struct _FilterOp
+{
+    int	    type;
+    char    *arg1;
+    char    *arg2;
+} FilterOp;
+
+/* Affine color transform : each row gives an output channel as a linear
+ * combination of the fetched texel channels, plus a constant in the last
+ * column */
+typedef struct _ColorMatrix
+{
+    double m[4][5];
+} ColorMatrix;
+
+typedef struct _FilterProgram FilterProgram;
+
+struct _FilterProgram
+{
+    char	    *path;
+    time_t	    mtime;
+    off_t	    size;
+
+    FilterOp	    *ops;
+    int		    nOps;
+
+    /* Set if the whole program reduces to an affine color transform */
+    Bool	    isMatrix;
+    ColorMatrix	    matrix;
+
+    FilterProgram   *next;
+};
+
 char *base_name (char *str);
 
 int buildFragmentProgram (char *source, char *name,
@@ -53,3 +92,8 @@ int buildFragmentProgram (char *source, char *name,
 
 int loadFragmentProgram (char *file, char *name,
                          CompScreen *s, int target);
+
+int loadFusedFragmentPrograms (char **files, int nFiles,
+                               CompScreen *s, int target, int *functions);
+
+void freeFragmentProgramCache (void);
@@ -252,6 +252,7 @@ typedef struct _ZoomScreen {
 static void syncCenterToMouse (CompScreen *s);
 static void updateMouseInterval (CompScreen *s, int x, int y);
 static void updateFocusInterval (CompScreen *s, FocusEventNode *list);
+static void disableFocusPolling (CompScreen *s);
 static void cursorZoomActive (CompScreen *s);
 static void cursorZoomInactive (CompScreen *s);
 static void restrainCursor (CompScreen *s, int out);
@@ -583,6 +584,11 @@ zoomPreparePaintScreen (CompScreen *s,
 		{
 		    za->xVelocity = za->yVelocity = 0.0f;
 		    zs->grabbed &= ~(1 << za->output);
+
+		    /* focus updates only arrive with new events, so don't
+		     * wait for one to stop listening */
+		    if (!zs->grabbed)
+			disableFocusPolling (s);
 		}
 	    }
 	}
@@ -901,6 +907,17 @@ enableFocusPolling (CompScreen *s)
     zs->lastFocusChange = getTime ();
 }
 
+/* Disables polling of focus position */
+static void
+disableFocusPolling (CompScreen *s)
+{
+    ZOOM_SCREEN (s);
+    ZOOM_DISPLAY (s->display);
+    if (zs->pollFocusHandle)
+	(*zd->fpFunc->removeFocusPolling) (s, zs->pollFocusHandle);
+    zs->pollFocusHandle = 0;
+}
+
 /* Sets the zoom (or scale) level. 
  * Cleans up if we are suddenly zoomed out. 
  */
@@ -1538,12 +1555,7 @@ updateFocusInterval (CompScreen *s, FocusEventNode *list)
 
     ZOOM_SCREEN (s);
     if (!zs->grabbed)
-    {
-	ZOOM_DISPLAY (s->display);
-	if (zs->pollFocusHandle)
-		(*zd->fpFunc->removeFocusPolling) (s, zs->pollFocusHandle);
-	zs->pollFocusHandle = 0;
-    }
+	disableFocusPolling (s);
 }
 
 /* Free a cursor */
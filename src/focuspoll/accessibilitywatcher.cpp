@@ -355,6 +355,7 @@ AccessibilityWatcher::AccessibilityWatcher () :
     mActive (false),
     screenWidth (0),
     screenHeight (0),
+    filters (strings),
     readingEventsEnabled (false),
     focusListener (NULL),
     caretMoveListener (NULL),
@@ -392,33 +393,44 @@ AccessibilityWatcher::~AccessibilityWatcher ()
     g_object_unref (readingModeListener);
 };
 
-static gchar *
-getLabel (AtspiAccessible *accessible)
+void
+AccessibilityWatcher::setIgnoreLinks (bool val)
+{
+    ignoreLinks = val;
+}
+
+void
+AccessibilityWatcher::resetFilterRules (void)
 {
-    auto relations = unique_gobject_garray (atspi_accessible_get_relation_set (accessible, NULL));
-    if (relations.get () == NULL)
+    filters.reset ();
+}
+
+bool
+AccessibilityWatcher::addFilterRule (const gchar *rule)
+{
+    return filters.addRule (rule);
+}
+
+/*
+ * Records the events that reach the filters to path, or stops recording
+ * if path is NULL.
+ */
+bool
+AccessibilityWatcher::setTraceFile (const gchar *path)
+{
+    if (!path)
     {
-	return g_strdup ("");
+	trace.close ();
+	return true;
     }
 
-    for (guint i = 0; i < relations.get ()->len; ++i) {
-	AtspiRelation *relation = g_array_index (relations.get (), AtspiRelation*, i);
-	if (relation == NULL)
-	    continue;
-	if (atspi_relation_get_relation_type (relation) == ATSPI_RELATION_LABELLED_BY)
-	{
-	    auto target = unique_gobject (atspi_relation_get_target (relation, 0));
-	    gchar * res_label = atspi_accessible_get_name (target.get (), NULL);
-	    return (res_label == NULL) ? g_strdup ("") : res_label;
-	}
-    }
-    return g_strdup ("");
+    return trace.open (path);
 }
 
 void
-AccessibilityWatcher::setIgnoreLinks (bool val)
+AccessibilityWatcher::setCoalescing (const gchar *type, FocusCoalescing coalescing)
 {
-    ignoreLinks = val;
+    focusQueue.setCoalescing (type, coalescing);
 }
 
 void
@@ -444,23 +456,27 @@ void
 AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
 {
     // type is registered from filter on calling event
+    struct timeval arrival;
+    gettimeofday (&arrival, 0);
+
     auto application = unique_gobject (atspi_accessible_get_application (event->source, NULL));
-    FocusInfo *res = new FocusInfo (type,
-		   atspi_accessible_get_name (event->source, NULL),
-		   getLabel (event->source),
-		   atspi_accessible_get_role_name (event->source, NULL),
-		   atspi_accessible_get_name (application.get (), NULL));
+    auto role = unique_gmem (atspi_accessible_get_role_name (event->source, NULL));
+    auto appName = unique_gmem (atspi_accessible_get_name (application.get (), NULL));
+    FocusInfo res (type,
+		   strings.intern (role.get ()),
+		   strings.intern (appName.get ()));
+    res.source = event->source;
+    res.arrival = arrival;
 
     auto stateSet0 = unique_gobject (atspi_accessible_get_state_set (event->source));
     if (!atspi_state_set_contains (stateSet0.get (), ATSPI_STATE_SHOWING) ||
         !atspi_state_set_contains (stateSet0.get (), ATSPI_STATE_VISIBLE))
     {
 	/* This is not actually on-screen, its coordinates will not mean anything */
-	delete (res);
 	return;
     }
 
-    if (!res->active)
+    if (!res.active)
     {
 	// prevents skipping events that are not designated as active. we check the activeness of parents.
 	auto parent = unique_gobject (atspi_accessible_get_parent (event->source, NULL));
@@ -469,7 +485,7 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
 	    auto stateSet = unique_gobject (atspi_accessible_get_state_set (parent.get ()));
 	    if (atspi_state_set_contains (stateSet.get (), ATSPI_STATE_ACTIVE))
 	    {
-		res->active = true;
+		res.active = true;
 	    }
 	    if (atspi_state_set_contains (stateSet.get (), ATSPI_STATE_EXPANDABLE))
 	    {
@@ -479,7 +495,6 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
 		    if (!strcmp (role.get (), "menu"))
 		    {
 			// parent is expandable but not expanded, we do not want to track what is happening inside
-			delete (res);
 			return;
 		    }
 		}
@@ -496,12 +511,11 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
 
     auto component_target = unique_gobject_ref (event->source);
 
-    if (strcmp (res->type, "active-descendant-changed") == 0)
+    if (strcmp (res.type, "active-descendant-changed") == 0)
     {
 	component_target = unique_gobject (atspi_accessible_get_child_at_index (component_target.get (), event->detail1, NULL));
 	if (!component_target.get ())
 	{
-	    delete (res);
 	    return;
 	}
     }
@@ -547,10 +561,10 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
     if (component.get ())
     {
 	auto size = unique_gmem (atspi_component_get_extents (component.get (), ATSPI_COORD_TYPE_SCREEN, NULL));
-	res->x = size.get ()->x;
-	res->y = size.get ()->y;
-	res->w = size.get ()->width;
-	res->h = size.get ()->height;
+	res.x = size.get ()->x;
+	res.y = size.get ()->y;
+	res.w = size.get ()->width;
+	res.h = size.get ()->height;
     }
 
     // getting the states on event
@@ -563,7 +577,6 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
     {
 	if (!text.get ())
 	{
-	    delete (res);
 	    return;
 	}
 	auto offset = atspi_text_get_caret_offset (text.get (), NULL);
@@ -572,180 +585,148 @@ AccessibilityWatcher::activityEvent (const AtspiEvent *event, const gchar *type)
 	if (offset)
 	{
 	    auto size = unique_gmem (atspi_text_get_character_extents (text.get (), offset, ATSPI_COORD_TYPE_SCREEN, NULL));
-	    res->x = size.get ()->x;
-	    res->y = size.get ()->y;
-	    res->w = size.get ()->width;
-	    res->h = size.get ()->height;
+	    res.x = size.get ()->x;
+	    res.y = size.get ()->y;
+	    res.w = size.get ()->width;
+	    res.h = size.get ()->height;
 	}
 	// correcting a missing offset when caret is at end of text
-	if (((res->x == 0 && res->y == 0) ||
-	     res->x + res->w < 0 ||
-	     res->y + res->h < 0)
+	if (((res.x == 0 && res.y == 0) ||
+	     res.x + res.w < 0 ||
+	     res.y + res.h < 0)
 	    && offset > 0)
 	{
 	    auto size = unique_gmem (atspi_text_get_character_extents (text.get (), offset-1, ATSPI_COORD_TYPE_SCREEN, NULL));
-	    res->x = size.get ()->x;
-	    res->y = size.get ()->y;
-	    res->w = size.get ()->width;
-	    res->h = size.get ()->height;
+	    res.x = size.get ()->x;
+	    res.y = size.get ()->y;
+	    res.w = size.get ()->width;
+	    res.h = size.get ()->height;
 	}
 	// when result is obviously not a caret size
 	if ((strcmp (event->type, "object:text-caret-moved") == 0 || strcmp (type, "caret") != 0) &&
-	    (res->w > A11YWATCHER_MAX_CARET_WIDTH || res->h > A11YWATCHER_MAX_CARET_HEIGHT))
+	    (res.w > A11YWATCHER_MAX_CARET_WIDTH || res.h > A11YWATCHER_MAX_CARET_HEIGHT))
 	{
 	    auto size = unique_gmem (atspi_text_get_character_extents (text.get (), offset, ATSPI_COORD_TYPE_SCREEN, NULL));
-	    res->x = size.get ()->x;
-	    res->y = size.get ()->y;
-	    res->w = size.get ()->width;
-	    res->h = size.get ()->height;
-	    if (res->w > A11YWATCHER_MAX_CARET_WIDTH || res->h > A11YWATCHER_MAX_CARET_HEIGHT)
+	    res.x = size.get ()->x;
+	    res.y = size.get ()->y;
+	    res.w = size.get ()->width;
+	    res.h = size.get ()->height;
+	    if (res.w > A11YWATCHER_MAX_CARET_WIDTH || res.h > A11YWATCHER_MAX_CARET_HEIGHT)
 	    {
-		res->x = 0;
-		res->y = 0;
+		res.x = 0;
+		res.y = 0;
 	    }
 	}
 
 	// still no offset, it's probably a newline and we're at bugzilla #1319273 (with new paragraph obj)
-	if (((res->x == 0 && res->y == 0) || (res->x == -1 && res->y == -1)) &&
+	if (((res.x == 0 && res.y == 0) || (res.x == -1 && res.y == -1)) &&
 	    (strcmp (event->type, "object:text-changed:insert") == 0 ||
 	     strcmp (event->type, "object:text-changed:removed") == 0 ||
 	     strcmp (event->type, "object:text-caret-moved") == 0 ||
 	     strcmp (type, "caret") != 0)) {
 	    getAlternativeCaret (res, event);
-	    res->x = res->xAlt;
-	    res->y = res->yAlt;
-	    res->w = res->wAlt;
-	    res->h = res->hAlt;
+	    res.x = res.xAlt;
+	    res.y = res.yAlt;
+	    res.w = res.wAlt;
+	    res.h = res.hAlt;
 	}
     }
 
     if (atspi_state_set_contains (stateSet.get (), ATSPI_STATE_FOCUSED))
     {
-	res->focused = true;
+	res.focused = true;
 	// reset potential menu stack
-	for (auto info: previouslyActiveMenus) {
-	   delete (info);
-	}
 	previouslyActiveMenus.clear ();
     }
     if (atspi_state_set_contains (stateSet.get (), ATSPI_STATE_SELECTED))
     {
-	res->selected = true;
+	res.selected = true;
     }
-    if (strcmp (res->type, "state-changed:selected") == 0 && event->detail1 == 1)
+    if (strcmp (res.type, "state-changed:selected") == 0 && event->detail1 == 1)
     {
-	res->selected = true;
-	if (strcmp (res->role, "paragraph") == 0)
+	res.selected = true;
+	if (strcmp (strings.lookup (res.role), "paragraph") == 0)
 	    // E.g. LO selects the paragraph object when making a selection
 	    // inside the paragraph, which makes us jump to the beginning of
 	    // the paragraph. We do not actually care about this, the selection
 	    // inside the paragraph is what is interesting.
 	    return;
-	FocusInfo *dup = new FocusInfo (*res);
 	// add to stack of menus
-	previouslyActiveMenus.push_back (dup);
+	previouslyActiveMenus.push (res);
     }
 
+    trace.write (res, event->type, strings);
+
     if (appSpecificFilter (res, event))
     {
 	return;
     }
-    if (filterBadEvents (res))
+    if (filterBadEvents (res, screenWidth, screenHeight))
     {
-	delete (res);
 	return;
     }
     queueFocus (res);
 }
 
 bool
-AccessibilityWatcher::appSpecificFilter (FocusInfo *focus, const AtspiEvent* event)
+AccessibilityWatcher::appSpecificFilter (FocusInfo &focus, const AtspiEvent* event)
 {
-    if (strcmp (focus->type, "state-changed:selected") == 0 && // emulates on-change:selected missing event for menus
-	(strcmp (focus->role, "menu item") == 0 ||
-	 strcmp (focus->role, "menu") == 0 ||
-	 strcmp (focus->role, "check menu item") == 0 ||
-	 strcmp (focus->role, "radio menu item") == 0 ||
-	 strcmp (focus->role, "tearoff menu item") == 0) &&
-	strcmp (focus->application, "mate-panel") != 0)
+    FocusFilterActions actions = filters.lookup (focus.application, focus.role,
+						  strings.intern (focus.type));
+
+    if (!actions)
+	return false;
+
+    if (filterByRules (focus, actions, event->type, ignoreLinks,
+		       previouslyActiveMenus, focusQueue))
+	return true;
+
+    if (actions & FOCUS_FILTER (FocusFilterInputLine))
     {
-	if (!focus->selected && returnToPrevMenu ())
-	{
-	    // The submenu item told us that he lost selection.  We have thus
-	    // returned to the parent menu (which unfortunately won't tell us
-	    // anything)
-	    delete (focus);
-	    return true;
-	}
-	focus->active = true;
-    }
-    if (strcmp (focus->application, "soffice") == 0 && strcmp (focus->role, "paragraph") == 0)
-    { // LO-calc: avoid spam event from main edit line
 	auto parent = unique_gobject (atspi_accessible_get_parent (event->source, NULL));
 	auto parentLabel = unique_gmem (atspi_accessible_get_name (parent.get (), NULL));
 	if (!strcmp (parentLabel.get (), "Input line") ||
 	    !strcmp (parentLabel.get (), "Ligne de saisie"))
 	{
-	    delete (focus);
 	    return true;
 	}
     }
-    if (strcmp (focus->application, "Icedove") == 0 || strcmp (focus->application, "Thunderbird") == 0)
+    if (actions & FOCUS_FILTER (FocusFilterNewlineCaret))
     {
-	if (strcmp (focus->type, "caret") == 0)
-	{
-	    auto text = unique_gobject (atspi_accessible_get_text (event->source)); // next if deals with a special newline char, that remained buggy. hypra issue #430
-	    auto offset = atspi_text_get_caret_offset (text.get (), NULL);
-	    auto string = unique_gmem (atspi_text_get_string_at_offset (text.get (), offset, ATSPI_TEXT_GRANULARITY_CHAR, NULL));
-	    auto stringM1 = unique_gmem (atspi_text_get_string_at_offset (text.get (), offset - 1, ATSPI_TEXT_GRANULARITY_CHAR, NULL));
-	    gchar character = string.get ()->content[0];
-	    gchar characterM1 = stringM1.get ()->content[0];
-
-	    if (offset == atspi_text_get_character_count (text.get (), NULL) && character == '\0' && characterM1 == '\n')
-	    {
-		getAlternativeCaret (focus, event);
-		focus->x = focus->xAlt;
-		focus->y = focus->yAlt;
-		focus->w = focus->wAlt;
-		focus->h = focus->hAlt;
-	    }
-	    if (!((focus->x == 0 && focus->y == 0) || (focus->x == -1 && focus->y == -1)))
-	    { // prevents compose window loss of tracking in HTML mode (active flag ok, but no focused flag)
-		queueFocus (focus);
-		return true;
-	    }
-	    auto component = unique_gobject (atspi_accessible_get_component (event->source));
-	    if (component.get ())
-	    {
-		auto size = unique_gmem (atspi_component_get_extents (component.get (), ATSPI_COORD_TYPE_SCREEN, NULL));
-		focus->x = size.get ()->x;
-		focus->y = size.get ()->y;
-		focus->w = 7;
-		focus->h = size.get ()->height;
-		queueFocus (focus);
-		return true;
-	    }
-	}
-    }
-    if (strcmp (focus->application, "Firefox") == 0)
-    {
-	if (ignoreLinks && strcmp (focus->type, "caret") != 0 && strcmp (focus->role, "link") == 0)
+	auto text = unique_gobject (atspi_accessible_get_text (event->source));
+	auto offset = atspi_text_get_caret_offset (text.get (), NULL);
+	auto string = unique_gmem (atspi_text_get_string_at_offset (text.get (), offset, ATSPI_TEXT_GRANULARITY_CHAR, NULL));
+	auto stringM1 = unique_gmem (atspi_text_get_string_at_offset (text.get (), offset - 1, ATSPI_TEXT_GRANULARITY_CHAR, NULL));
+	gchar character = string.get ()->content[0];
+	gchar characterM1 = stringM1.get ()->content[0];
+
+	if (offset == atspi_text_get_character_count (text.get (), NULL) && character == '\0' && characterM1 == '\n')
 	{
-	    delete (focus);
-	    return true;
+	    getAlternativeCaret (focus, event);
+	    focus.x = focus.xAlt;
+	    focus.y = focus.yAlt;
+	    focus.w = focus.wAlt;
+	    focus.h = focus.hAlt;
 	}
-	// prevents status bar focus in firefox
-	if (strcmp (focus->type, "caret") == 0 &&
-	    (strcmp (event->type, "object:text-changed:insert:system") == 0 ||
-	     strcmp (event->type, "object:text-changed:delete:system") == 0)) {
-	    delete (focus);
+	if (!((focus.x == 0 && focus.y == 0) || (focus.x == -1 && focus.y == -1)))
+	{ // prevents compose window loss of tracking in HTML mode (active flag ok, but no focused flag)
+	    queueFocus (focus);
 	    return true;
 	}
-	if (strcmp (focus->type, "focus") == 0 && strcmp (focus->role, "document frame") == 0)
-	{ // general page parasite event
-	    delete (focus);
+	auto component = unique_gobject (atspi_accessible_get_component (event->source));
+	if (component.get ())
+	{
+	    auto size = unique_gmem (atspi_component_get_extents (component.get (), ATSPI_COORD_TYPE_SCREEN, NULL));
+	    focus.x = size.get ()->x;
+	    focus.y = size.get ()->y;
+	    focus.w = 7;
+	    focus.h = size.get ()->height;
+	    queueFocus (focus);
 	    return true;
 	}
+    }
+    if (actions & FOCUS_FILTER (FocusFilterEditableCaret))
+    {
 	auto text = unique_gobject (atspi_accessible_get_text (event->source));
 	bool isEditableText = false;
 	if (text.get ())
@@ -753,94 +734,24 @@ AccessibilityWatcher::appSpecificFilter (FocusInfo *focus, const AtspiEvent* eve
 	    auto stateSet = unique_gobject (atspi_accessible_get_state_set (event->source));
 	    isEditableText = atspi_state_set_contains (stateSet.get (), ATSPI_STATE_EDITABLE);
 	}
-	if ((strcmp (focus->type, "caret") == 0 || isEditableText) &&
-	    !((focus->x == 0 && focus->y == 0) || (focus->x == -1 && focus->y == -1)))
+	if ((strcmp (focus.type, "caret") == 0 || isEditableText) &&
+	    !((focus.x == 0 && focus.y == 0) || (focus.x == -1 && focus.y == -1)))
 	{
 	    queueFocus (focus);
 	    return true;
 	}
 	getAlternativeCaret (focus, event);
-	if ((strcmp (focus->type, "caret") == 0 || isEditableText) &&
-	    !((focus->xAlt == 0 && focus->yAlt == 0) || (focus->xAlt == -1 && focus->yAlt == -1)))
+	if ((strcmp (focus.type, "caret") == 0 || isEditableText) &&
+	    !((focus.xAlt == 0 && focus.yAlt == 0) || (focus.xAlt == -1 && focus.yAlt == -1)))
 	{
-	    focus->x = focus->xAlt;
-	    focus->y = focus->yAlt;
-	    focus->w = focus->wAlt;
-	    focus->h = focus->hAlt;
+	    focus.x = focus.xAlt;
+	    focus.y = focus.yAlt;
+	    focus.w = focus.wAlt;
+	    focus.h = focus.hAlt;
 	    queueFocus (focus);
 	    return true;
 	}
     }
-    if (strcmp (focus->application, "evince") == 0 && strcmp (focus->type, "state-changed:selected") == 0 && strcmp (focus->role, "icon") == 0)
-    { // LO-calc: avoid spam event from main edit line
-	delete (focus);
-	return true; // ignores the parasite event from evince icon
-    }
-    return false;
-}
-
-bool
-AccessibilityWatcher::filterBadEvents (const FocusInfo *event)
-{
-    if (strcmp (event->type, "notification") == 0)
-    {
-       // notifications don't have to be focused
-       return false;
-    }
-    if (strcmp (event->type, "caret") == 0 && event->x ==0 && event->y == 0)
-    {
-	return true;
-    }
-    if (!event->active)
-    {
-	return true;
-    }
-    if (!event->focused && !event->selected)
-    {
-	return true;
-    }
-    if (event->w < 0 ||
-	event->h < 0)
-    {
-	return true;
-    }
-    if (event->x == 0 &&
-	event->y == 0 &&
-	event->w == 0 &&
-	event->h == 0)
-    {
-	return true;
-    }
-    if (event->x + event->w < 0 ||
-	event->y + event->h < 0)
-    {
-	return true;
-    }
-    if (getScreenWidth () != 0 && getScreenHeight () != 0 &&
-	(event->x > getScreenWidth () ||
-	 event->y > getScreenHeight () ||
-	 event->w > getScreenWidth () ||
-	 event->h > getScreenHeight ()))
-    {
-	return true;
-    }
-    return false;
-}
-
-/*
- * This simulates a "selected" event from the parent menu when closing
- * a submenu.
- */
-bool
-AccessibilityWatcher::returnToPrevMenu ()
-{
-    if (previouslyActiveMenus.size () > 1)
-    {
-	previouslyActiveMenus.pop_back ();
-	FocusInfo *dup = new FocusInfo (*previouslyActiveMenus.back ());
-	queueFocus (dup);
-	return true;
-    }
     return false;
 }
 
@@ -850,7 +761,7 @@ AccessibilityWatcher::returnToPrevMenu ()
  * or at-spi bugs.
  */
 void
-AccessibilityWatcher::getAlternativeCaret (FocusInfo *focus, const AtspiEvent* event)
+AccessibilityWatcher::getAlternativeCaret (FocusInfo &focus, const AtspiEvent* event)
 {
     auto text = unique_gobject (atspi_accessible_get_text (event->source));
     if (!text.get ())
@@ -896,16 +807,16 @@ AccessibilityWatcher::getAlternativeCaret (FocusInfo *focus, const AtspiEvent* e
 	    ++charIndex;
 	}
 	if (charExtentsFound) {
-	    focus->xAlt = size.get ()->x;
-	    focus->yAlt = size.get ()->y + lines * size.get ()->height;
-	    focus->wAlt = size.get ()->width;
-	    focus->hAlt = size.get ()->height;
+	    focus.xAlt = size.get ()->x;
+	    focus.yAlt = size.get ()->y + lines * size.get ()->height;
+	    focus.wAlt = size.get ()->width;
+	    focus.hAlt = size.get ()->height;
 	} else {
 	    size = unique_gmem (atspi_text_get_character_extents (text.get (), offset, ATSPI_COORD_TYPE_SCREEN, NULL));
-	    focus->xAlt = size.get ()->x;
-	    focus->yAlt = size.get ()->y;
-	    focus->wAlt = size.get ()->width;
-	    focus->hAlt = size.get ()->height;
+	    focus.xAlt = size.get ()->x;
+	    focus.yAlt = size.get ()->y;
+	    focus.wAlt = size.get ()->width;
+	    focus.hAlt = size.get ()->height;
 	}
     }
 }
@@ -931,6 +842,8 @@ void
 AccessibilityWatcher::readingEvent (const AtspiEvent *event, const gchar *type)
 {
     // type is registered from filter on calling event
+    struct timeval arrival;
+    gettimeofday (&arrival, 0);
 
     if (! readingEventsEnabled)
 	return;
@@ -946,16 +859,17 @@ AccessibilityWatcher::readingEvent (const AtspiEvent *event, const gchar *type)
     }
 #endif
     auto application = unique_gobject (atspi_accessible_get_application (event->source, NULL));
-    FocusInfo *res = new FocusInfo (type,
-		   atspi_accessible_get_name (event->source, NULL),
-		   getLabel (event->source),
-		   atspi_accessible_get_role_name (event->source, NULL),
-		   atspi_accessible_get_name (application.get (), NULL));
+    auto role = unique_gmem (atspi_accessible_get_role_name (event->source, NULL));
+    auto appName = unique_gmem (atspi_accessible_get_name (application.get (), NULL));
+    FocusInfo res (type,
+		   strings.intern (role.get ()),
+		   strings.intern (appName.get ()));
+    res.source = event->source;
+    res.arrival = arrival;
 
     auto text = unique_gobject (atspi_accessible_get_text (event->source));
     if (!text.get ())
     {
-	delete (res);
 	return;
     }
     int start = event->detail1, end = event->detail2;
@@ -971,24 +885,22 @@ AccessibilityWatcher::readingEvent (const AtspiEvent *event, const gchar *type)
     auto rect = unique_gmem (atspi_text_get_range_extents (text.get(), start, end, ATSPI_COORD_TYPE_SCREEN, NULL));
     if (!rect.get ())
     {
-	delete (res);
 	return;
     }
 
-    res->active = true;
-    res->focused = true;
-    res->x = rect.get ()->x;
-    res->y = rect.get ()->y;
-    res->w = rect.get ()->width;
-    res->h = rect.get ()->height;
+    res.active = true;
+    res.focused = true;
+    res.x = rect.get ()->x;
+    res.y = rect.get ()->y;
+    res.w = rect.get ()->width;
+    res.h = rect.get ()->height;
 
     /* restore the null-width */
     if (event->detail1 == event->detail2)
-	res->w = 0;
+	res.w = 0;
 
-    if (filterBadEvents(res))
+    if (filterBadEvents (res, screenWidth, screenHeight))
     {
-	delete (res);
 	return;
     }
 
@@ -1041,33 +953,15 @@ AccessibilityWatcher::setActive (bool activate)
 }
 
 void
-AccessibilityWatcher::queueFocus (FocusInfo *inf) {
-    /* dedup events on a per-type basis */
-    for (auto it = focusList.begin(); it != focusList.end(); ) {
-	auto it_info = *it;
-	if (strcmp (it_info->type, inf->getType()) == 0) {
-	    it = focusList.erase(it);
-	    delete (it_info);
-	    break;
-	} else {
-	    it++;
-	}
-    }
-    focusList.push_front (inf); /* fits the way the list is built in focuspoll.cpp */
+AccessibilityWatcher::queueFocus (const FocusInfo &inf) {
+    /* events are merged according to their type when the queue is drained */
+    focusQueue.push (inf.type, inf.source, inf.x, inf.y, inf.w, inf.h,
+		     &inf.arrival);
 }
 
-std::deque <FocusInfo *>
+FocusQueue &
 AccessibilityWatcher::getFocusQueue ()
 {
-    return focusList;
-}
-
-void
-AccessibilityWatcher::resetFocusQueue ()
-{
-    for (auto info: focusList) {
-       delete (info);
-    }
-    focusList.clear ();
+    return focusQueue;
 }
 
@@ -20,10 +20,12 @@
 #ifndef ACCESSIBILITY_WATCHER_H
 #define ACCESSIBILITY_WATCHER_H
 
-#include <deque>
 #include <vector>
 
 #include "focusinfo.h"
+#include "focusfilter.h"
+#include "focusqueue.h"
+#include "focustrace.h"
 
 #include <atspi/atspi.h>
 
@@ -36,14 +38,16 @@ class AccessibilityWatcher
 	void setActive (bool);
 
 	void setIgnoreLinks (bool);
+	void setCoalescing (const gchar *, FocusCoalescing);
+	void resetFilterRules (void);
+	bool addFilterRule (const gchar *);
+	bool setTraceFile (const gchar *);
 	void setScreenLimits (int, int);
 	int getScreenWidth (void);
 	int getScreenHeight (void);
 
-	void queueFocus (FocusInfo *);
-	std::deque<FocusInfo *> getFocusQueue (void);
-	void resetFocusQueue (void);
-	bool returnToPrevMenu (void);
+	void queueFocus (const FocusInfo &);
+	FocusQueue & getFocusQueue (void);
 
 	void activityEvent (const AtspiEvent *event, const gchar *type);
 	void readingEvent (const AtspiEvent *event, const gchar *type);
@@ -54,8 +58,11 @@ class AccessibilityWatcher
 	int screenWidth;
 	int screenHeight;
 	static bool ignoreLinks;
-	std::deque<FocusInfo*> focusList;
-	std::vector<FocusInfo*> previouslyActiveMenus;
+	FocusQueue focusQueue;
+	FocusMenuStack previouslyActiveMenus;
+	FocusStringTable strings;
+	FocusFilterTable filters;
+	FocusTraceWriter trace;
 	bool readingEventsEnabled;
 
 	AtspiEventListener *focusListener;
@@ -69,9 +76,8 @@ class AccessibilityWatcher
 	void addWatches (void);
 	void removeWatches (void);
 
-	bool appSpecificFilter (FocusInfo *focusInfo, const AtspiEvent* event);
-	bool filterBadEvents (const FocusInfo *event);
-	void getAlternativeCaret (FocusInfo *focus, const AtspiEvent* event);
+	bool appSpecificFilter (FocusInfo &focusInfo, const AtspiEvent* event);
+	void getAlternativeCaret (FocusInfo &focus, const AtspiEvent* event);
 };
 
 #endif
@@ -0,0 +1,308 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "focusfilter.h"
+
+#include <string.h>
+
+static const char *actionNames[FocusFilterActionNum] = {
+    "menu-selection",
+    "link",
+    "system-text",
+    "drop",
+    "input-line",
+    "newline-caret",
+    "editable-caret"
+};
+
+FocusFilterTable::FocusFilterTable (FocusStringTable &strings) :
+    strings (strings)
+{
+    reset ();
+}
+
+/*
+ * Restores the built-in rules.
+ */
+void
+FocusFilterTable::reset (void)
+{
+    static const char *menuRoles[] = {
+	"menu item",
+	"menu",
+	"check menu item",
+	"radio menu item",
+	"tearoff menu item"
+    };
+
+    rules.clear ();
+    resolved.clear ();
+
+    for (const char *role: menuRoles)
+	appendRule (NULL, role, "state-changed:selected", FocusFilterMenuSelection);
+    appendRule ("mate-panel", NULL, "state-changed:selected",
+		FocusFilterMenuSelection, false);
+
+    // LO-calc: avoid spam event from main edit line
+    appendRule ("soffice", "paragraph", NULL, FocusFilterInputLine);
+
+    // special newline char, that remained buggy. hypra issue #430
+    appendRule ("Icedove", NULL, "caret", FocusFilterNewlineCaret);
+    appendRule ("Thunderbird", NULL, "caret", FocusFilterNewlineCaret);
+
+    appendRule ("Firefox", "link", NULL, FocusFilterLink);
+    appendRule ("Firefox", "link", "caret", FocusFilterLink, false);
+    // prevents status bar focus in firefox
+    appendRule ("Firefox", NULL, "caret", FocusFilterSystemText);
+    // general page parasite event
+    appendRule ("Firefox", "document frame", "focus", FocusFilterDrop);
+    appendRule ("Firefox", NULL, NULL, FocusFilterEditableCaret);
+
+    // parasite event from evince icon
+    appendRule ("evince", "icon", "state-changed:selected", FocusFilterDrop);
+}
+
+FocusStringId
+FocusFilterTable::internField (const gchar *field)
+{
+    if (!field || strcmp (field, "*") == 0)
+	return any;
+
+    return strings.intern (field);
+}
+
+void
+FocusFilterTable::appendRule (const gchar *application,
+			      const gchar *role,
+			      const gchar *type,
+			      FocusFilterAction action,
+			      bool enable)
+{
+    Rule rule;
+
+    rule.application = internField (application);
+    rule.role = internField (role);
+    rule.type = internField (type);
+    rule.action = action;
+    rule.enable = enable;
+
+    rules.push_back (rule);
+    resolved.clear ();
+}
+
+/*
+ * Parses a rule of the form "application,role,type,action", where "*"
+ * matches anything and a '!' in front of the action disables it.
+ */
+bool
+FocusFilterTable::addRule (const gchar *rule)
+{
+    std::string fields[4];
+    unsigned int n = 0;
+
+    for (const gchar *c = rule; *c; c++)
+    {
+	if (*c == ',')
+	{
+	    if (++n == 4)
+		return false;
+	    continue;
+	}
+	fields[n] += *c;
+    }
+
+    if (n != 3)
+	return false;
+
+    const gchar *name = fields[3].c_str ();
+    bool enable = true;
+
+    if (*name == '!')
+    {
+	enable = false;
+	name++;
+    }
+
+    for (int action = 0; action < FocusFilterActionNum; action++)
+    {
+	if (strcmp (actionNames[action], name) == 0)
+	{
+	    appendRule (fields[0].c_str (), fields[1].c_str (), fields[2].c_str (),
+			(FocusFilterAction) action, enable);
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+FocusFilterActions
+FocusFilterTable::lookup (FocusStringId application,
+			  FocusStringId role,
+			  FocusStringId type)
+{
+    Key key = { application, role, type };
+
+    auto it = resolved.find (key);
+    if (it != resolved.end ())
+	return it->second;
+
+    FocusFilterActions actions = 0;
+
+    for (const Rule &rule: rules)
+    {
+	if ((rule.application != any && rule.application != application) ||
+	    (rule.role != any && rule.role != role) ||
+	    (rule.type != any && rule.type != type))
+	    continue;
+
+	if (rule.enable)
+	    actions |= FOCUS_FILTER (rule.action);
+	else
+	    actions &= ~FOCUS_FILTER (rule.action);
+    }
+
+    resolved.emplace (key, actions);
+
+    return actions;
+}
+
+void
+FocusMenuStack::push (const FocusInfo &menu)
+{
+    menus.push_back (menu);
+}
+
+void
+FocusMenuStack::clear (void)
+{
+    menus.clear ();
+}
+
+/*
+ * This simulates a "selected" event from the parent menu when closing
+ * a submenu.
+ */
+bool
+FocusMenuStack::returnToParent (FocusQueue &queue)
+{
+    if (menus.size () > 1)
+    {
+	menus.pop_back ();
+
+	// the parent menu is focused again now, not when it was first seen
+	FocusInfo focus = menus.back ();
+	gettimeofday (&focus.arrival, 0);
+	queue.push (focus.type, focus.source,
+		    focus.x, focus.y, focus.w, focus.h, &focus.arrival);
+	return true;
+    }
+    return false;
+}
+
+/*
+ * Applies the workarounds that only need the event itself.
+ */
+bool
+filterByRules (FocusInfo &focus,
+	       FocusFilterActions actions,
+	       const gchar *eventType,
+	       bool ignoreLinks,
+	       FocusMenuStack &menus,
+	       FocusQueue &queue)
+{
+    if (actions & FOCUS_FILTER (FocusFilterMenuSelection))
+    { // emulates on-change:selected missing event for menus
+	if (!focus.selected && menus.returnToParent (queue))
+	{
+	    // The submenu item told us that he lost selection.  We have thus
+	    // returned to the parent menu (which unfortunately won't tell us
+	    // anything)
+	    return true;
+	}
+	focus.active = true;
+    }
+    if (actions & FOCUS_FILTER (FocusFilterLink) && ignoreLinks)
+    {
+	return true;
+    }
+    if (actions & FOCUS_FILTER (FocusFilterSystemText) &&
+	(strcmp (eventType, "object:text-changed:insert:system") == 0 ||
+	 strcmp (eventType, "object:text-changed:delete:system") == 0))
+    {
+	return true;
+    }
+    if (actions & FOCUS_FILTER (FocusFilterDrop))
+    {
+	return true;
+    }
+    return false;
+}
+
+/*
+ * Drops events without a usable position. The screen limits are only
+ * checked when they are known.
+ */
+bool
+filterBadEvents (const FocusInfo &event,
+		 int screenWidth,
+		 int screenHeight)
+{
+    if (strcmp (event.type, "notification") == 0)
+    {
+       // notifications don't have to be focused
+       return false;
+    }
+    if (strcmp (event.type, "caret") == 0 && event.x ==0 && event.y == 0)
+    {
+	return true;
+    }
+    if (!event.active)
+    {
+	return true;
+    }
+    if (!event.focused && !event.selected)
+    {
+	return true;
+    }
+    if (event.w < 0 ||
+	event.h < 0)
+    {
+	return true;
+    }
+    if (event.x == 0 &&
+	event.y == 0 &&
+	event.w == 0 &&
+	event.h == 0)
+    {
+	return true;
+    }
+    if (event.x + event.w < 0 ||
+	event.y + event.h < 0)
+    {
+	return true;
+    }
+    if (screenWidth != 0 && screenHeight != 0 &&
+	(event.x > screenWidth ||
+	 event.y > screenHeight ||
+	 event.w > screenWidth ||
+	 event.h > screenHeight))
+    {
+	return true;
+    }
+    return false;
+}
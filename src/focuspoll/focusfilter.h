@@ -0,0 +1,129 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FOCUS_FILTER_H
+#define FOCUS_FILTER_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "focusinfo.h"
+#include "focusqueue.h"
+
+#define FOCUS_FILTER(action) (1 << (action))
+
+/*
+ * Application specific workarounds, applied in this order. The ones that
+ * need to query the accessible come last.
+ */
+enum FocusFilterAction
+{
+    FocusFilterMenuSelection = 0, // emulate the selection event of the parent menu
+    FocusFilterLink,              // drop link focus when links are ignored
+    FocusFilterSystemText,        // drop caret moves from system text changes
+    FocusFilterDrop,              // drop the event
+    FocusFilterInputLine,         // drop events of the spreadsheet input line
+    FocusFilterNewlineCaret,      // place the caret after a trailing newline
+    FocusFilterEditableCaret,     // prefer caret extents in editable text
+    FocusFilterActionNum
+};
+
+typedef unsigned int FocusFilterActions;
+
+/*
+ * Rules selecting the workarounds by application, role and event type.
+ *
+ * The rules are matched once for each combination that shows up, and the
+ * resulting actions are cached, so filtering an event costs a single lookup
+ * however many rules there are. Later rules override earlier ones.
+ */
+class FocusFilterTable
+{
+    public:
+	FocusFilterTable (FocusStringTable &strings);
+
+	void reset (void);
+	bool addRule (const gchar *rule);
+
+	FocusFilterActions lookup (FocusStringId application,
+				   FocusStringId role,
+				   FocusStringId type);
+
+    private:
+	static const FocusStringId any = ~0u;
+
+	struct Rule {
+	    FocusStringId     application;
+	    FocusStringId     role;
+	    FocusStringId     type;
+	    FocusFilterAction action;
+	    bool              enable;
+	};
+
+	struct Key {
+	    FocusStringId application;
+	    FocusStringId role;
+	    FocusStringId type;
+
+	    bool operator== (const Key &other) const
+	    {
+		return application == other.application &&
+		       role == other.role &&
+		       type == other.type;
+	    }
+	};
+
+	struct KeyHash {
+	    size_t operator() (const Key &key) const
+	    {
+		return (key.application * 31 + key.role) * 31 + key.type;
+	    }
+	};
+
+	FocusStringId internField (const gchar *field);
+	void appendRule (const gchar *application, const gchar *role,
+			 const gchar *type, FocusFilterAction action,
+			 bool enable = true);
+
+	FocusStringTable &strings;
+	std::vector <Rule> rules;
+	std::unordered_map <Key, FocusFilterActions, KeyHash> resolved;
+};
+
+/*
+ * Menus whose items got selected, innermost last. Submenus don't tell when
+ * they are closed, so the parent menu is focused again once an item of the
+ * submenu loses its selection.
+ */
+class FocusMenuStack
+{
+    public:
+	void push (const FocusInfo &menu);
+	void clear (void);
+	bool returnToParent (FocusQueue &queue);
+
+    private:
+	std::vector <FocusInfo> menus;
+};
+
+bool filterByRules (FocusInfo &focus, FocusFilterActions actions,
+		    const gchar *eventType, bool ignoreLinks,
+		    FocusMenuStack &menus, FocusQueue &queue);
+bool filterBadEvents (const FocusInfo &event,
+		      int screenWidth, int screenHeight);
+
+#endif
@@ -22,11 +22,41 @@
 #include <stdio.h>
 #include <string.h>
 
+FocusStringTable::FocusStringTable ()
+{
+    intern ("");
+}
+
+FocusStringId
+FocusStringTable::intern (const gchar *str)
+{
+    if (!str)
+	return 0;
+
+    auto it = ids.find (str);
+    if (it != ids.end ())
+	return it->second;
+
+    FocusStringId id = strings.size ();
+    it = ids.emplace (str, id).first;
+    // map keys never move, so the table can hand out pointers to them
+    strings.push_back (it->first.c_str ());
+
+    return id;
+}
+
+const gchar *
+FocusStringTable::lookup (FocusStringId id) const
+{
+    if (id >= strings.size ())
+	return "";
+
+    return strings[id];
+}
+
 FocusInfo::FocusInfo (const gchar * type,
-		      gchar * name,
-		      gchar * label,
-		      gchar * role,
-		      gchar * application,
+		      FocusStringId role,
+		      FocusStringId application,
 		      int x,
 		      int y,
 		      int width,
@@ -40,42 +70,15 @@ FocusInfo::FocusInfo (const gchar * type,
     wAlt (0),
     hAlt (0),
     type (type),
-    name (name),
-    label (label),
     role (role),
     application (application),
+    source (NULL),
     active (false),
     focused (false),
     selected (false)
 {
-}
-
-FocusInfo::FocusInfo (const FocusInfo &dup)
-{
-    x = dup.x;
-    y = dup.y;
-    w = dup.w;
-    h = dup.h;
-    xAlt = dup.xAlt;
-    yAlt = dup.yAlt;
-    wAlt = dup.wAlt;
-    hAlt = dup.hAlt;
-    type = dup.type;
-    name = strdup(dup.name);
-    label = strdup(dup.label);
-    role = strdup(dup.role);
-    application = strdup(dup.application);
-    active = dup.active;
-    focused = dup.focused;
-    selected = dup.selected;
-}
-
-FocusInfo::~FocusInfo (void)
-{
-    g_free (name);
-    g_free (label);
-    g_free (role);
-    g_free (application);
+    arrival.tv_sec = 0;
+    arrival.tv_usec = 0;
 }
 
 const gchar *
@@ -110,10 +113,8 @@ FocusInfo::operator== (const FocusInfo& other) const
 	    other.w == w &&
 	    other.h == h &&
 	    !strcmp (other.type, type) &&
-	    !strcmp (other.name, name) &&
-	    !strcmp (other.label, label) &&
-	    !strcmp (other.application, application) &&
-	    !strcmp (other.role, role));
+	    other.application == application &&
+	    other.role == role);
 };
 
 bool
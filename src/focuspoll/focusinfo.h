@@ -22,6 +22,9 @@
 
 #include <string>
 #include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <sys/time.h>
 #include <glib.h>
 
 class CompPoint {
@@ -61,32 +64,49 @@ public:
     }
 };
 
+typedef unsigned int FocusStringId;
+
+/*
+ * Table of the role and application names seen in focus events, so that
+ * events only carry small ids instead of their own copies of the strings.
+ * Id 0 is always the empty string.
+ */
+class FocusStringTable
+{
+    public:
+	FocusStringTable ();
+
+	FocusStringId intern (const gchar *str);
+	const gchar * lookup (FocusStringId id) const;
+
+    private:
+	std::unordered_map <std::string, FocusStringId> ids;
+	std::vector <const gchar *> strings;
+};
+
 
 class FocusInfo
 {
     public:
 
 	FocusInfo (const gchar * type = "",
-		   gchar * name = g_strdup (""),
-		   gchar * label = g_strdup (""),
-		   gchar * role = g_strdup (""),
-		   gchar * application = g_strdup (""),
+		   FocusStringId role = 0,
+		   FocusStringId application = 0,
 		   int x = -1,
 		   int y = -1,
 		   int width = -1,
 		   int height = -1);
 
-	FocusInfo (const FocusInfo &dup);
-
-	~FocusInfo ();
-
 	int x, y, w, h;
 	int xAlt, yAlt, wAlt, hAlt;
 	const gchar * type;
-	gchar * name;
-	gchar * label;
-	gchar * role;
-	gchar * application;
+	FocusStringId role;
+	FocusStringId application;
+
+	// identifies the accessible the event came from, never dereferenced
+	gconstpointer source;
+	// when the AT-SPI event was received
+	struct timeval arrival;
 
 	// AT-SPI events that are interesting to know about the event
 	bool active;
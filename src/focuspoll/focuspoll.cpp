@@ -33,6 +33,11 @@
  * GNU General Public License for more details.
  */
 
+#include <sys/time.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <compiz-core.h>
 
 #include <compiz-focuspoll.h>
@@ -59,9 +64,34 @@ typedef enum _FocuspollDisplayOptions
     FP_DISPLAY_OPTION_INDEX,
     FP_DISPLAY_OPTION_IGNORE_LINKS,
     FP_DISPLAY_OPTION_FOCUS_POLL_INTERVAL,
+    FP_DISPLAY_OPTION_FOCUS_COALESCING,
+    FP_DISPLAY_OPTION_CARET_COALESCING,
+    FP_DISPLAY_OPTION_SELECTION_COALESCING,
+    FP_DISPLAY_OPTION_FILTER_RULES,
+    FP_DISPLAY_OPTION_DUMP_LATENCY_KEY,
+    FP_DISPLAY_OPTION_RECORD_TRACE,
+    FP_DISPLAY_OPTION_TRACE_FILE,
     FP_DISPLAY_OPTION_NUM
 } FocuspollDisplayOptions;
 
+#define FOCUSPOLL_LATENCY_BUCKETS 12
+
+/* bucket i counts samples below 250us << i, the last one all others */
+typedef struct _FocuspollLatency {
+    unsigned int  count[FOCUSPOLL_LATENCY_BUCKETS];
+    unsigned int  nSample;
+    unsigned long total; /* microseconds */
+    unsigned long max;
+} FocuspollLatency;
+
+typedef enum _FocuspollLatencyStage
+{
+    FP_LATENCY_WATCHER,  /* event received until queued by the watcher */
+    FP_LATENCY_DISPATCH, /* event received until passed to the clients */
+    FP_LATENCY_CLIENT,   /* events passed on until a client returned */
+    FP_LATENCY_NUM
+} FocuspollLatencyStage;
+
 typedef struct _FocuspollDisplay {
     int	screenPrivateIndex;
 
@@ -75,6 +105,12 @@ typedef struct _FocuspollScreen {
 
     CompTimeoutHandle updateHandle;
 
+    /* set when the watcher wakes us up on new events instead of polling */
+    CompWatchFdHandle watchHandle;
+    struct timeval    lastDispatch;
+
+    FocuspollLatency latency[FP_LATENCY_NUM];
+
     AccessibilityWatcher* a11ywatcher;
 } FocuspollScreen;
 
@@ -92,46 +128,146 @@ typedef struct _FocuspollScreen {
 
 #define NUM_OPTIONS(s) (sizeof ((s)->opt) / sizeof (CompOption))
 
-static Bool
-updatePosition (void *c)
+static long
+getTimeDiffUs (const struct timeval *t1,
+	       const struct timeval *t0)
 {
-    CompScreen      *s = (CompScreen *)c;
-    FocuspollClient *fc;
+    return (t1->tv_sec - t0->tv_sec) * 1000000 +
+	   (t1->tv_usec - t0->tv_usec);
+}
+
+static void
+addLatencySample (FocuspollLatency *latency,
+		  long             usec)
+{
+    int i = 0;
+
+    if (usec < 0)
+	usec = 0;
+
+    while (i < FOCUSPOLL_LATENCY_BUCKETS - 1 && usec >= (250L << i))
+	i++;
+
+    latency->count[i]++;
+    latency->nSample++;
+    latency->total += usec;
+    if ((unsigned long) usec > latency->max)
+	latency->max = usec;
+}
+
+static void
+dispatchEvents (CompScreen *s)
+{
+    FocuspollClient *fc, *next;
+    FocusEventNode  *node;
+    struct timeval  dispatched, started, handled, arrival, queued;
 
     FOCUSPOLL_SCREEN (s);
 
-    auto queue = fs->a11ywatcher->getFocusQueue ();
-    FocusEventNode *cqueue = NULL;
-    for (auto fit = queue.begin(); fit != queue.end(); ++fit)
+    FocusQueue &queue = fs->a11ywatcher->getFocusQueue ();
+    FocusEventNode *events = queue.drain ();
+
+    /* clients are only called with events, an empty tick or a wakeup for
+       events that were cleared meanwhile is not a dispatch */
+    if (!events)
     {
-	auto current = new FocusEventNode;
-	current->next = cqueue;
-	cqueue = current;
-	auto info = *fit;
-	CompRect focusRect = info->getBBox ();
-	current->type = info->type;
-	current->x = focusRect.x;
-	current->y = focusRect.y;
-	current->width = focusRect.width;
-	current->height = focusRect.height;
+	queue.release ();
+	return;
+    }
+
+    gettimeofday (&dispatched, 0);
+
+    for (node = events; node; node = node->next)
+    {
+	queue.getTimes (node, &arrival, &queued);
+	addLatencySample (&fs->latency[FP_LATENCY_WATCHER],
+			  getTimeDiffUs (&queued, &arrival));
+	addLatencySample (&fs->latency[FP_LATENCY_DISPATCH],
+			  getTimeDiffUs (&dispatched, &arrival));
     }
 
-    FocuspollClient *next;
     for (fc = fs->clients; fc; fc = next)
     {
 	next = fc->next;
 	if (fc->update)
-	    (*fc->update) (s, cqueue);
+	{
+	    /* each client is timed on its own, not with the ones before it */
+	    gettimeofday (&started, 0);
+
+	    (*fc->update) (s, events);
+
+	    gettimeofday (&handled, 0);
+	    addLatencySample (&fs->latency[FP_LATENCY_CLIENT],
+			      getTimeDiffUs (&handled, &started));
+	}
     }
 
-    for (FocusEventNode *cur = cqueue; cur;)
+    queue.release ();
+
+    gettimeofday (&fs->lastDispatch, 0);
+}
+
+static Bool
+delayedDispatch (void *c)
+{
+    CompScreen *s = (CompScreen *)c;
+
+    FOCUSPOLL_SCREEN (s);
+
+    fs->updateHandle = 0;
+    dispatchEvents (s);
+
+    return FALSE;
+}
+
+/* Events have been queued, pass them on unless the last dispatch was less
+   than a poll interval ago. */
+static Bool
+focusEventsReady (void *c)
+{
+    CompScreen     *s = (CompScreen *)c;
+    struct timeval tv;
+    int            interval, elapsed;
+
+    FOCUSPOLL_SCREEN (s);
+    FOCUSPOLL_DISPLAY (s->display);
+
+    FocusQueue &queue = fs->a11ywatcher->getFocusQueue ();
+    queue.acknowledge ();
+
+    if (!fs->clients)
     {
-      auto next = cur->next;
-      delete cur;
-      cur = next;
+	queue.clear ();
+	return TRUE;
     }
 
-    fs->a11ywatcher->resetFocusQueue ();
+    if (fs->updateHandle)
+	return TRUE;
+
+    gettimeofday (&tv, 0);
+
+    interval = fd->opt[FP_DISPLAY_OPTION_FOCUS_POLL_INTERVAL].value.i;
+    elapsed  = (tv.tv_sec - fs->lastDispatch.tv_sec) * 1000 +
+	       (tv.tv_usec - fs->lastDispatch.tv_usec) / 1000;
+
+    if (elapsed >= 0 && elapsed < interval)
+	fs->updateHandle = compAddTimeout (interval - elapsed,
+					   interval - elapsed,
+					   delayedDispatch, s);
+    else
+	dispatchEvents (s);
+
+    return TRUE;
+}
+
+static Bool
+updatePosition (void *c)
+{
+    CompScreen *s = (CompScreen *)c;
+
+    FOCUSPOLL_SCREEN (s);
+
+    dispatchEvents (s);
 
     if (!fs->clients)
     {
@@ -171,7 +307,12 @@ focuspollAddFocusPolling (CompScreen         *s,
 
     fs->clients = fc;
 
-    if (start)
+    if (start && fs->watchHandle)
+    {
+	fs->a11ywatcher->getFocusQueue ().clear ();
+	fs->a11ywatcher->setActive (true);
+    }
+    else if (start)
     {
 	fs->a11ywatcher->setActive (true);
 	fs->updateHandle =
@@ -190,17 +331,7 @@ focuspollRemoveFocusPolling (CompScreen            *s,
 {
     FOCUSPOLL_SCREEN (s);
 
-    FocuspollClient *fc = fs->clients;
-
-    if (fs->clients && fs->clients->id == id)
-    {
-	fs->clients = fs->clients->next;
-	if (fs->clients)
-	    fs->clients->prev = NULL;
-
-	free (fc);
-	return;
-    }
+    FocuspollClient *fc;
 
     for (fc = fs->clients; fc; fc = fc->next)
 	if (fc->id == id)
@@ -209,9 +340,144 @@ focuspollRemoveFocusPolling (CompScreen            *s,
 		fc->next->prev = fc->prev;
 	    if (fc->prev)
 		fc->prev->next = fc->next;
+	    else
+		fs->clients = fc->next;
 	    free (fc);
-	    return;
+	    break;
+	}
+
+    /* without a wake fd, the poll timer stops itself on its next run */
+    if (!fs->clients && fs->watchHandle)
+    {
+	fs->a11ywatcher->setActive (false);
+
+	if (fs->updateHandle)
+	{
+	    compRemoveTimeout (fs->updateHandle);
+	    fs->updateHandle = 0;
 	}
+    }
+}
+
+static void
+updateCoalescing (CompScreen *s)
+{
+    FOCUSPOLL_DISPLAY (s->display);
+    FOCUSPOLL_SCREEN (s);
+
+    FocusCoalescing focus = (FocusCoalescing)
+	fd->opt[FP_DISPLAY_OPTION_FOCUS_COALESCING].value.i;
+    FocusCoalescing caret = (FocusCoalescing)
+	fd->opt[FP_DISPLAY_OPTION_CARET_COALESCING].value.i;
+    FocusCoalescing selection = (FocusCoalescing)
+	fd->opt[FP_DISPLAY_OPTION_SELECTION_COALESCING].value.i;
+
+    fs->a11ywatcher->setCoalescing ("focus", focus);
+    fs->a11ywatcher->setCoalescing ("active-descendant-changed", focus);
+    fs->a11ywatcher->setCoalescing ("caret", caret);
+    fs->a11ywatcher->setCoalescing ("region-changed", caret);
+    fs->a11ywatcher->setCoalescing ("state-changed:selected", selection);
+}
+
+static void
+updateFilterRules (CompScreen *s)
+{
+    FOCUSPOLL_DISPLAY (s->display);
+    FOCUSPOLL_SCREEN (s);
+
+    CompListValue *rules = &fd->opt[FP_DISPLAY_OPTION_FILTER_RULES].value.list;
+    int           i;
+
+    fs->a11ywatcher->resetFilterRules ();
+
+    for (i = 0; i < rules->nValue; i++)
+    {
+	if (!fs->a11ywatcher->addFilterRule (rules->value[i].s))
+	    compLogMessage ("focuspoll", CompLogLevelWarn,
+			    "Invalid filter rule \"%s\"", rules->value[i].s);
+    }
+}
+
+static void
+logLatency (const char             *name,
+	    const FocuspollLatency *latency)
+{
+    char buf[512];
+    int  i, len = 0;
+
+    if (!latency->nSample)
+    {
+	compLogMessage ("focuspoll", CompLogLevelInfo, "%s: no events", name);
+	return;
+    }
+
+    for (i = 0; i < FOCUSPOLL_LATENCY_BUCKETS; i++)
+    {
+	const char *fmt = (i < FOCUSPOLL_LATENCY_BUCKETS - 1) ?
+			  "%s<%gms: %u" : "%s>=%gms: %u";
+	double     bound = (250L << MIN (i, FOCUSPOLL_LATENCY_BUCKETS - 2)) /
+			   1000.0;
+
+	len += snprintf (buf + len, sizeof (buf) - len, fmt,
+			 i ? ", " : "", bound, latency->count[i]);
+	if (len >= (int) sizeof (buf))
+	    break;
+    }
+
+    compLogMessage ("focuspoll", CompLogLevelInfo,
+		    "%s: %u events, mean %.2fms, max %.2fms (%s)",
+		    name, latency->nSample,
+		    latency->total / 1000.0 / latency->nSample,
+		    latency->max / 1000.0, buf);
+}
+
+/* Logs the latency histograms collected since the last dump. */
+static Bool
+focuspollDumpLatency (CompDisplay     *d,
+		      CompAction      *action,
+		      CompActionState state,
+		      CompOption      *option,
+		      int             nOption)
+{
+    CompScreen *s;
+    Window     xid;
+
+    xid = getIntOptionNamed (option, nOption, "root", 0);
+    s = findScreenAtDisplay (d, xid);
+
+    if (s)
+    {
+	FOCUSPOLL_SCREEN (s);
+
+	logLatency ("Received to queued", &fs->latency[FP_LATENCY_WATCHER]);
+	logLatency ("Received to dispatched", &fs->latency[FP_LATENCY_DISPATCH]);
+	logLatency ("Dispatched to handled", &fs->latency[FP_LATENCY_CLIENT]);
+
+	memset (fs->latency, 0, sizeof (fs->latency));
+
+	return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+updateTrace (CompScreen *s)
+{
+    FOCUSPOLL_DISPLAY (s->display);
+    FOCUSPOLL_SCREEN (s);
+
+    const char *path = fd->opt[FP_DISPLAY_OPTION_TRACE_FILE].value.s;
+
+    if (!fd->opt[FP_DISPLAY_OPTION_RECORD_TRACE].value.b || !*path)
+    {
+	fs->a11ywatcher->setTraceFile (NULL);
+	return;
+    }
+
+    if (!fs->a11ywatcher->setTraceFile (path))
+	compLogMessage ("focuspoll", CompLogLevelWarn,
+			"Cannot record focus events to \"%s\"", path);
 }
 
 static CompSize
@@ -229,7 +495,14 @@ static const CompMetadataOptionInfo focuspollDisplayOptionInfo[] = {
     { "abi", "int", 0, 0, 0 },
     { "index", "int", 0, 0, 0 },
     { "ignore_links", "bool", 0, 0, 0 },
-    { "focus_poll_interval", "int", "<min>1</min><max>500</max><default>10</default>", 0, 0 }
+    { "focus_poll_interval", "int", "<min>1</min><max>500</max><default>10</default>", 0, 0 },
+    { "focus_coalescing", "int", "<min>0</min><max>2</max><default>2</default>", 0, 0 },
+    { "caret_coalescing", "int", "<min>0</min><max>2</max><default>2</default>", 0, 0 },
+    { "selection_coalescing", "int", "<min>0</min><max>2</max><default>2</default>", 0, 0 },
+    { "filter_rules", "list", "<type>string</type>", 0, 0 },
+    { "dump_latency_key", "key", 0, focuspollDumpLatency, 0 },
+    { "record_trace", "bool", 0, 0, 0 },
+    { "trace_file", "string", 0, 0, 0 }
 };
 
 static CompOption *
@@ -274,7 +547,7 @@ focuspollSetDisplayOption (CompPlugin      *plugin,
 	for (s = display->screens; s; s = s->next)
 	{
 	    fs = GET_FOCUSPOLL_SCREEN (s, fd);
-	    if (fs->updateHandle)
+	    if (fs->updateHandle && !fs->watchHandle)
 	    {
 		compRemoveTimeout (fs->updateHandle);
 		fs->updateHandle =
@@ -287,6 +560,27 @@ focuspollSetDisplayOption (CompPlugin      *plugin,
 	}
 	return status;
 	break;
+    case FP_DISPLAY_OPTION_FOCUS_COALESCING:
+    case FP_DISPLAY_OPTION_CARET_COALESCING:
+    case FP_DISPLAY_OPTION_SELECTION_COALESCING:
+	status = compSetDisplayOption (display, o, value);
+	for (s = display->screens; s; s = s->next)
+	    updateCoalescing (s);
+	return status;
+	break;
+    case FP_DISPLAY_OPTION_FILTER_RULES:
+	status = compSetDisplayOption (display, o, value);
+	for (s = display->screens; s; s = s->next)
+	    updateFilterRules (s);
+	return status;
+	break;
+    case FP_DISPLAY_OPTION_RECORD_TRACE:
+    case FP_DISPLAY_OPTION_TRACE_FILE:
+	status = compSetDisplayOption (display, o, value);
+	for (s = display->screens; s; s = s->next)
+	    updateTrace (s);
+	return status;
+	break;
     default:
         return compSetDisplayOption (display, o, value);
     }
@@ -370,7 +664,22 @@ focuspollInitScreen (CompPlugin *p,
 
     fs->updateHandle = 0;
 
+    fs->lastDispatch.tv_sec  = 0;
+    fs->lastDispatch.tv_usec = 0;
+
+    memset (fs->latency, 0, sizeof (fs->latency));
+
+    fs->watchHandle = 0;
+    int wakeFd = fs->a11ywatcher->getFocusQueue ().getWakeFd ();
+    if (wakeFd >= 0)
+	fs->watchHandle = compAddWatchFd (wakeFd, POLLIN, focusEventsReady, s);
+
     s->base.privates[fd->screenPrivateIndex].ptr = fs;
+
+    updateCoalescing (s);
+    updateFilterRules (s);
+    updateTrace (s);
+
     return TRUE;
 }
 
@@ -380,6 +689,9 @@ focuspollFiniScreen (CompPlugin *p,
 {
     FOCUSPOLL_SCREEN (s);
 
+    if (fs->watchHandle)
+	compRemoveWatchFd (fs->watchHandle);
+
     delete fs->a11ywatcher;
 
     if (fs->updateHandle)
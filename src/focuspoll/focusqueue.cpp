@@ -0,0 +1,383 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "focusqueue.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+FocusQueue::FocusQueue () :
+    nOverflows (0),
+    overflowPending (false),
+    nDrainedOverflows (0),
+    nCoalescings (0),
+    head (0),
+    tail (0),
+    drained (0),
+    wakePending (false)
+{
+    if (pipe (wakePipe) < 0)
+    {
+	wakePipe[0] = wakePipe[1] = -1;
+	return;
+    }
+
+    fcntl (wakePipe[0], F_SETFL, O_NONBLOCK);
+    fcntl (wakePipe[1], F_SETFL, O_NONBLOCK);
+}
+
+FocusQueue::~FocusQueue ()
+{
+    if (wakePipe[0] >= 0)
+    {
+	close (wakePipe[0]);
+	close (wakePipe[1]);
+    }
+}
+
+void
+FocusQueue::setCoalescing (const char *type, FocusCoalescing coalescing)
+{
+    for (unsigned int i = 0; i < nCoalescings; i++)
+    {
+	if (strcmp (coalescings[i].type, type) == 0)
+	{
+	    coalescings[i].coalescing = coalescing;
+	    return;
+	}
+    }
+
+    if (nCoalescings < maxTypes)
+    {
+	coalescings[nCoalescings].type = type;
+	coalescings[nCoalescings].coalescing = coalescing;
+	nCoalescings++;
+    }
+}
+
+FocusCoalescing
+FocusQueue::getCoalescing (const char *type) const
+{
+    for (unsigned int i = 0; i < nCoalescings; i++)
+    {
+	if (strcmp (coalescings[i].type, type) == 0)
+	    return coalescings[i].coalescing;
+    }
+
+    return FocusCoalesceType;
+}
+
+void
+FocusQueue::fill (Record *record, const char *type, const void *source,
+		  int x, int y, int width, int height,
+		  const struct timeval *arrival)
+{
+    record->node.next = NULL;
+    record->node.type = type;
+    record->node.x = x;
+    record->node.y = y;
+    record->node.width = width;
+    record->node.height = height;
+    record->source = source;
+    record->arrival = *arrival;
+    gettimeofday (&record->queued, 0);
+}
+
+void
+FocusQueue::wake (void)
+{
+    if (wakePipe[1] >= 0 && !wakePending.exchange (true))
+    {
+	char c = 0;
+	ssize_t ret = write (wakePipe[1], &c, 1);
+	(void) ret;
+    }
+}
+
+/*
+ * Keeps the record aside in place of the last one of its type, called
+ * with the overflow lock held. Returns false if there are too many types
+ * set aside already.
+ */
+bool
+FocusQueue::overflow (const char *type, const void *source,
+		      int x, int y, int width, int height,
+		      const struct timeval *arrival)
+{
+    unsigned int i;
+
+    for (i = 0; i < nOverflows; i++)
+	if (strcmp (overflows[i].node.type, type) == 0)
+	    break;
+
+    if (i == maxTypes)
+	return false;
+
+    // move it to the end, so the set aside records stay in arrival order
+    if (i < nOverflows)
+    {
+	memmove (&overflows[i], &overflows[i + 1],
+		 (nOverflows - i - 1) * sizeof (Record));
+	nOverflows--;
+    }
+
+    fill (&overflows[nOverflows++], type, source, x, y, width, height, arrival);
+    overflowPending.store (true, std::memory_order_release);
+
+    return true;
+}
+
+/*
+ * Appends a record. The consumer owns the records in the ring until it
+ * releases them, so when the ring is full the record replaces the last one
+ * of its type set aside, and is moved into the ring once there is room.
+ */
+bool
+FocusQueue::push (const char *type, const void *source,
+		  int x, int y, int width, int height,
+		  const struct timeval *arrival)
+{
+    unsigned int h = head.load (std::memory_order_relaxed);
+
+    if (overflowPending.load (std::memory_order_acquire))
+    {
+	std::lock_guard <std::mutex> lock (overflowLock);
+	unsigned int t = tail.load (std::memory_order_acquire);
+	unsigned int n = 0;
+
+	// drain may have taken them meanwhile
+	while (n < nOverflows && h - t < size)
+	    records[h++ % size] = overflows[n++];
+
+	memmove (&overflows[0], &overflows[n],
+		 (nOverflows - n) * sizeof (Record));
+	nOverflows -= n;
+
+	head.store (h, std::memory_order_release);
+
+	if (nOverflows || h - t == size)
+	{
+	    bool kept = overflow (type, source, x, y, width, height, arrival);
+
+	    wake ();
+	    return kept;
+	}
+
+	overflowPending.store (false, std::memory_order_relaxed);
+    }
+    else if (h - tail.load (std::memory_order_acquire) == size)
+    {
+	std::lock_guard <std::mutex> lock (overflowLock);
+	bool kept = overflow (type, source, x, y, width, height, arrival);
+
+	wake ();
+	return kept;
+    }
+
+    fill (&records[h % size], type, source, x, y, width, height, arrival);
+
+    head.store (h + 1, std::memory_order_release);
+
+    wake ();
+
+    return true;
+}
+
+bool
+FocusQueue::empty (void) const
+{
+    return head.load (std::memory_order_acquire) ==
+	   tail.load (std::memory_order_relaxed);
+}
+
+/*
+ * Links the pending records into a list, oldest first, merging them
+ * according to the coalescing of their type. Records that repeat the
+ * rectangle of the next record of the same type are always dropped.
+ * The records set aside while the ring was full are newer than the ones
+ * in it, and come last. The list stays valid until release ().
+ */
+FocusEventNode *
+FocusQueue::drain (void)
+{
+    unsigned int t = tail.load (std::memory_order_relaxed);
+    unsigned int h;
+    const char *types[maxTypes];
+    const Record *sources[maxSources];
+    const Record *newer[maxTypes];
+    unsigned int nTypes = 0, nSources = 0;
+    FocusEventNode *first = NULL;
+
+    nDrainedOverflows = 0;
+
+    if (overflowPending.load (std::memory_order_acquire))
+    {
+	// read head under the lock, so it can't move records out meanwhile
+	std::lock_guard <std::mutex> lock (overflowLock);
+
+	h = head.load (std::memory_order_acquire);
+
+	memcpy (drainedOverflows, overflows, nOverflows * sizeof (Record));
+	nDrainedOverflows = nOverflows;
+	nOverflows = 0;
+
+	overflowPending.store (false, std::memory_order_relaxed);
+    }
+    else
+    {
+	h = head.load (std::memory_order_acquire);
+    }
+
+    // walk from newest to oldest, so that prepending keeps arrival order
+    for (unsigned int i = h - t + nDrainedOverflows; i; i--)
+    {
+	Record *record;
+
+	if (i > h - t)
+	    record = &drainedOverflows[i - 1 - (h - t)];
+	else
+	    record = &records[(t + i - 1) % size];
+
+	const FocusEventNode *node = &record->node;
+	unsigned int j;
+
+	for (j = 0; j < nTypes; j++)
+	    if (strcmp (types[j], node->type) == 0)
+		break;
+
+	if (j == nTypes)
+	{
+	    if (nTypes == maxTypes)
+	    {
+		// too many types to track, pass it on unmerged
+		record->node.next = first;
+		first = &record->node;
+		continue;
+	    }
+	    types[nTypes] = node->type;
+	    newer[nTypes] = NULL;
+	    nTypes++;
+	}
+
+	const Record *next = newer[j];
+
+	if (next &&
+	    next->node.x == node->x && next->node.y == node->y &&
+	    next->node.width == node->width && next->node.height == node->height)
+	    continue;
+
+	switch (getCoalescing (node->type)) {
+	case FocusCoalesceType:
+	    if (next)
+		continue;
+	    break;
+	case FocusCoalesceSource:
+	{
+	    bool superseded = false;
+
+	    for (unsigned int k = 0; k < nSources; k++)
+	    {
+		if (sources[k]->source == record->source &&
+		    strcmp (sources[k]->node.type, node->type) == 0)
+		{
+		    superseded = true;
+		    break;
+		}
+	    }
+
+	    if (superseded)
+		continue;
+
+	    if (nSources < maxSources)
+		sources[nSources++] = record;
+	    break;
+	}
+	case FocusCoalesceNone:
+	    break;
+	}
+
+	newer[j] = record;
+
+	record->node.next = first;
+	first = &record->node;
+    }
+
+    drained = h;
+    return first;
+}
+
+void
+FocusQueue::release (void)
+{
+    tail.store (drained, std::memory_order_release);
+}
+
+void
+FocusQueue::clear (void)
+{
+    {
+	std::lock_guard <std::mutex> lock (overflowLock);
+
+	nOverflows = 0;
+	overflowPending.store (false, std::memory_order_relaxed);
+
+	drained = head.load (std::memory_order_acquire);
+    }
+
+    nDrainedOverflows = 0;
+    release ();
+}
+
+/*
+ * Returns the timestamps of a node handed out by drain ().
+ */
+void
+FocusQueue::getTimes (const FocusEventNode *node,
+		      struct timeval *arrival,
+		      struct timeval *queued) const
+{
+    const Record *record = reinterpret_cast <const Record *> (node);
+
+    *arrival = record->arrival;
+    *queued = record->queued;
+}
+
+/*
+ * Returns a fd that is readable while pushed records have not been
+ * acknowledged, or -1 if the consumer has to poll.
+ */
+int
+FocusQueue::getWakeFd (void) const
+{
+    return wakePipe[0];
+}
+
+/*
+ * Called by the consumer before draining, records pushed afterwards wake
+ * it up again.
+ */
+void
+FocusQueue::acknowledge (void)
+{
+    char buf[16];
+
+    while (read (wakePipe[0], buf, sizeof (buf)) > 0)
+	;
+
+    wakePending.store (false);
+}
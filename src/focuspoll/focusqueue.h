@@ -0,0 +1,128 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FOCUS_QUEUE_H
+#define FOCUS_QUEUE_H
+
+#include <atomic>
+#include <mutex>
+#include <sys/time.h>
+
+typedef struct _CompScreen CompScreen;
+
+#include <compiz-focuspoll.h>
+
+/*
+ * How events of one type are merged when the queue is drained.
+ */
+enum FocusCoalescing
+{
+    FocusCoalesceNone = 0,	// pass every event on
+    FocusCoalesceSource,	// keep the newest event of each accessible
+    FocusCoalesceType		// keep only the newest event
+};
+
+/*
+ * Bounded single producer, single consumer ring of focus events.
+ *
+ * The AT-SPI listener pushes fixed size records, and the poll timer drains
+ * them in place: the records are linked into the FocusEventNode list handed
+ * to the clients, so nothing is allocated or copied per event.
+ *
+ * When the ring is full, the newest event of each type is kept aside and
+ * handed out after the ring, so a burst loses the events in between rather
+ * than where the focus ended up.
+ *
+ * The wake fd becomes readable when records are pushed, so the consumer
+ * can sleep until there is something to drain.
+ */
+class FocusQueue
+{
+    public:
+	FocusQueue ();
+	~FocusQueue ();
+
+	void setCoalescing (const char *type, FocusCoalescing coalescing);
+
+	// producer side
+	bool push (const char *type, const void *source,
+		   int x, int y, int width, int height,
+		   const struct timeval *arrival);
+
+	// consumer side
+	bool empty (void) const;
+	FocusEventNode * drain (void);
+	void release (void);
+	void clear (void);
+
+	void getTimes (const FocusEventNode *node,
+		       struct timeval *arrival,
+		       struct timeval *queued) const;
+
+	int getWakeFd (void) const;
+	void acknowledge (void);
+
+    private:
+	static const unsigned int size = 1024;
+	static const unsigned int maxTypes = 16;
+	static const unsigned int maxSources = 64;
+
+	struct Record {
+	    FocusEventNode node;    // first, so drained nodes map back to records
+	    const void     *source; // identifies the accessible, never dereferenced
+	    struct timeval arrival; // when the AT-SPI event was received
+	    struct timeval queued;  // when the record was pushed
+	};
+
+	struct TypeCoalescing {
+	    const char      *type;
+	    FocusCoalescing coalescing;
+	};
+
+	FocusCoalescing getCoalescing (const char *type) const;
+	void fill (Record *record, const char *type, const void *source,
+		   int x, int y, int width, int height,
+		   const struct timeval *arrival);
+	bool overflow (const char *type, const void *source,
+		       int x, int y, int width, int height,
+		       const struct timeval *arrival);
+	void wake (void);
+
+	Record records[size];
+
+	// newest record of each type that did not fit, oldest first
+	Record overflows[maxTypes];
+	unsigned int nOverflows;
+	std::mutex overflowLock;
+	std::atomic <bool> overflowPending;
+
+	// overflows taken by drain, valid until release
+	Record drainedOverflows[maxTypes];
+	unsigned int nDrainedOverflows;
+
+	TypeCoalescing coalescings[maxTypes];
+	unsigned int nCoalescings;
+
+	std::atomic <unsigned int> head; // next record written by the producer
+	std::atomic <unsigned int> tail; // next record read by the consumer
+	unsigned int drained;            // end of the records passed out by drain
+
+	int wakePipe[2];
+	std::atomic <bool> wakePending;  // a wake up was written and not read yet
+};
+
+#endif
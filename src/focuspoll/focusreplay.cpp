@@ -0,0 +1,231 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Feeds a focus trace recorded by the focuspoll plugin through the filters
+ * and a queue with the given merging, and reports how long it took. The
+ * queue is drained whenever the recorded events span more than the poll
+ * interval, as the plugin would. Workarounds that have to query the
+ * accessible are skipped, so this runs without an accessibility stack.
+ */
+
+#include <memory>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "focusfilter.h"
+#include "focusqueue.h"
+#include "focustrace.h"
+
+struct FocusReplayStats
+{
+    unsigned int events;    // events read from the trace
+    unsigned int passed;    // events that passed the filters
+    unsigned int delivered; // events left after merging
+    long         usec;      // time spent filtering and queueing
+};
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+	     "Usage: %s [-i interval] [-l] [-r rule]... [-s width,height]\n"
+	     "       [-f coalescing] [-c coalescing] [-e coalescing] trace\n"
+	     "\n"
+	     "  -i  poll interval in milliseconds (10)\n"
+	     "  -l  ignore link focuses\n"
+	     "  -r  additional filter rule, as in the filter_rules option\n"
+	     "  -s  screen size, events outside of it are dropped\n"
+	     "  -f  focus event merging, 0 none, 1 per accessible, 2 newest (2)\n"
+	     "  -c  caret event merging (2)\n"
+	     "  -e  selection event merging (2)\n",
+	     name);
+}
+
+static bool
+parseCoalescing (const char *arg, FocusCoalescing *coalescing)
+{
+    char *end;
+    long value = strtol (arg, &end, 10);
+
+    if (*end || value < FocusCoalesceNone || value > FocusCoalesceType)
+	return false;
+
+    *coalescing = (FocusCoalescing) value;
+
+    return true;
+}
+
+static void
+flushReplayQueue (FocusQueue &queue, FocusReplayStats *stats)
+{
+    for (FocusEventNode *node = queue.drain (); node; node = node->next)
+	stats->delivered++;
+
+    queue.release ();
+}
+
+static void
+replay (const std::vector <FocusTraceEvent> &events,
+	FocusStringTable &strings,
+	FocusFilterTable &filters,
+	FocusQueue &queue,
+	int interval,
+	bool ignoreLinks,
+	int screenWidth,
+	int screenHeight,
+	FocusReplayStats *stats)
+{
+    FocusMenuStack menus;
+    struct timeval start, end, poll = { 0, 0 };
+
+    stats->events = events.size ();
+    stats->passed = 0;
+    stats->delivered = 0;
+
+    gettimeofday (&start, 0);
+
+    for (const FocusTraceEvent &event: events)
+    {
+	FocusInfo focus = event.focus;
+	FocusFilterActions actions = filters.lookup (focus.application,
+						     focus.role,
+						     strings.intern (focus.type));
+
+	if (actions && filterByRules (focus, actions, event.eventType,
+				      ignoreLinks, menus, queue))
+	    continue;
+	if (filterBadEvents (focus, screenWidth, screenHeight))
+	    continue;
+
+	stats->passed++;
+
+	long elapsed = (focus.arrival.tv_sec - poll.tv_sec) * 1000 +
+		       (focus.arrival.tv_usec - poll.tv_usec) / 1000;
+
+	if (elapsed >= interval || elapsed < 0)
+	{
+	    flushReplayQueue (queue, stats);
+	    poll = focus.arrival;
+	}
+
+	queue.push (focus.type, focus.source,
+		    focus.x, focus.y, focus.w, focus.h, &focus.arrival);
+    }
+
+    flushReplayQueue (queue, stats);
+
+    gettimeofday (&end, 0);
+
+    stats->usec = (end.tv_sec - start.tv_sec) * 1000000 +
+		  (end.tv_usec - start.tv_usec);
+}
+
+int
+main (int argc, char **argv)
+{
+    FocusStringTable strings;
+    FocusFilterTable filters (strings);
+    std::vector <FocusTraceEvent> events;
+    FocusReplayStats stats;
+    FocusCoalescing focus = FocusCoalesceType;
+    FocusCoalescing caret = FocusCoalesceType;
+    FocusCoalescing selection = FocusCoalesceType;
+    int interval = 10, screenWidth = 0, screenHeight = 0;
+    bool ignoreLinks = false;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "i:lr:s:f:c:e:")) != -1)
+    {
+	switch (opt) {
+	case 'i':
+	    interval = atoi (optarg);
+	    if (interval < 1)
+	    {
+		usage (argv[0]);
+		return 2;
+	    }
+	    break;
+	case 'l':
+	    ignoreLinks = true;
+	    break;
+	case 'r':
+	    if (!filters.addRule (optarg))
+	    {
+		fprintf (stderr, "Invalid filter rule \"%s\"\n", optarg);
+		return 2;
+	    }
+	    break;
+	case 's':
+	    if (sscanf (optarg, "%d,%d", &screenWidth, &screenHeight) != 2)
+	    {
+		usage (argv[0]);
+		return 2;
+	    }
+	    break;
+	case 'f':
+	case 'c':
+	case 'e':
+	    if (!parseCoalescing (optarg, opt == 'f' ? &focus :
+					  opt == 'c' ? &caret : &selection))
+	    {
+		usage (argv[0]);
+		return 2;
+	    }
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 2;
+	}
+    }
+
+    if (optind != argc - 1)
+    {
+	usage (argv[0]);
+	return 2;
+    }
+
+    if (!readFocusTrace (argv[optind], strings, events))
+    {
+	fprintf (stderr, "Cannot read focus events from \"%s\"\n",
+		 argv[optind]);
+	return 1;
+    }
+
+    // too large for the stack
+    std::unique_ptr <FocusQueue> queue (new FocusQueue ());
+
+    // the same event types the plugin options apply to
+    queue->setCoalescing ("focus", focus);
+    queue->setCoalescing ("active-descendant-changed", focus);
+    queue->setCoalescing ("caret", caret);
+    queue->setCoalescing ("region-changed", caret);
+    queue->setCoalescing ("state-changed:selected", selection);
+
+    replay (events, strings, filters, *queue, interval, ignoreLinks,
+	    screenWidth, screenHeight, &stats);
+
+    printf ("Replayed %u events in %.2fms (%.0f events/s): "
+	    "%u passed the filters, %u were passed on\n",
+	    stats.events, stats.usec / 1000.0,
+	    stats.usec ? stats.events * 1000000.0 / stats.usec : 0.0,
+	    stats.passed, stats.delivered);
+
+    return 0;
+}
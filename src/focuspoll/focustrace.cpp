@@ -0,0 +1,175 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "focustrace.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#define FOCUS_TRACE_FIELDS 9
+
+#define FOCUS_TRACE_ACTIVE   (1 << 0)
+#define FOCUS_TRACE_FOCUSED  (1 << 1)
+#define FOCUS_TRACE_SELECTED (1 << 2)
+
+FocusTraceWriter::FocusTraceWriter () :
+    file (NULL)
+{
+}
+
+FocusTraceWriter::~FocusTraceWriter ()
+{
+    close ();
+}
+
+bool
+FocusTraceWriter::open (const gchar *path)
+{
+    close ();
+
+    file = fopen (path, "a");
+
+    return file != NULL;
+}
+
+void
+FocusTraceWriter::close (void)
+{
+    if (file)
+    {
+	fclose (file);
+	file = NULL;
+    }
+}
+
+bool
+FocusTraceWriter::isOpen (void) const
+{
+    return file != NULL;
+}
+
+/* names come from the applications, keep them on their field and line */
+static void
+writeField (FILE *file, const gchar *str)
+{
+    for (; *str; str++)
+	fputc ((*str == '\t' || *str == '\n') ? ' ' : *str, file);
+    fputc ('\t', file);
+}
+
+void
+FocusTraceWriter::write (const FocusInfo &focus,
+			 const gchar *eventType,
+			 const FocusStringTable &strings)
+{
+    unsigned int flags = 0;
+
+    if (!file)
+	return;
+
+    if (focus.active)
+	flags |= FOCUS_TRACE_ACTIVE;
+    if (focus.focused)
+	flags |= FOCUS_TRACE_FOCUSED;
+    if (focus.selected)
+	flags |= FOCUS_TRACE_SELECTED;
+
+    fprintf (file, "%ld.%06ld\t",
+	     (long) focus.arrival.tv_sec, (long) focus.arrival.tv_usec);
+    writeField (file, focus.type);
+    writeField (file, eventType);
+    writeField (file, strings.lookup (focus.role));
+    writeField (file, strings.lookup (focus.application));
+    fprintf (file, "%lx\t%d %d %d %d\t%d %d %d %d\t%u\n",
+	     (unsigned long) (uintptr_t) focus.source,
+	     focus.x, focus.y, focus.w, focus.h,
+	     focus.xAlt, focus.yAlt, focus.wAlt, focus.hAlt,
+	     flags);
+}
+
+/*
+ * Reads a trace written by FocusTraceWriter. The names are interned in
+ * strings, which keeps the type strings alive as long as the table.
+ * Malformed lines are skipped.
+ */
+bool
+readFocusTrace (const gchar *path,
+		FocusStringTable &strings,
+		std::vector <FocusTraceEvent> &events)
+{
+    FILE *file = fopen (path, "r");
+    char line[1024];
+
+    if (!file)
+	return false;
+
+    while (fgets (line, sizeof (line), file))
+    {
+	char *fields[FOCUS_TRACE_FIELDS];
+	char *c = line;
+	int  n = 0;
+
+	if (line[0] == '#')
+	    continue;
+
+	line[strcspn (line, "\n")] = '\0';
+
+	while (n < FOCUS_TRACE_FIELDS)
+	{
+	    fields[n++] = c;
+	    c = strchr (c, '\t');
+	    if (!c)
+		break;
+	    *c++ = '\0';
+	}
+
+	if (n != FOCUS_TRACE_FIELDS)
+	    continue;
+
+	FocusTraceEvent event;
+	FocusInfo &focus = event.focus;
+	unsigned int flags;
+	unsigned long source;
+	long sec, usec;
+
+	if (sscanf (fields[0], "%ld.%ld", &sec, &usec) != 2 ||
+	    sscanf (fields[5], "%lx", &source) != 1 ||
+	    sscanf (fields[6], "%d %d %d %d",
+		    &focus.x, &focus.y, &focus.w, &focus.h) != 4 ||
+	    sscanf (fields[7], "%d %d %d %d",
+		    &focus.xAlt, &focus.yAlt, &focus.wAlt, &focus.hAlt) != 4 ||
+	    sscanf (fields[8], "%u", &flags) != 1)
+	    continue;
+
+	focus.arrival.tv_sec = sec;
+	focus.arrival.tv_usec = usec;
+	focus.type = strings.lookup (strings.intern (fields[1]));
+	event.eventType = strings.lookup (strings.intern (fields[2]));
+	focus.role = strings.intern (fields[3]);
+	focus.application = strings.intern (fields[4]);
+	focus.source = (gconstpointer) (uintptr_t) source;
+	focus.active = flags & FOCUS_TRACE_ACTIVE;
+	focus.focused = flags & FOCUS_TRACE_FOCUSED;
+	focus.selected = flags & FOCUS_TRACE_SELECTED;
+
+	events.push_back (event);
+    }
+
+    fclose (file);
+
+    return true;
+}
@@ -0,0 +1,64 @@
+/*
+ *   This file is part of compiz.
+ *
+ *   this program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by the Free
+ *   Software Foundation, either version 3 of the License, or (at your option) any
+ *   later version.
+ *
+ *   This program is distributed in the hope that it will be useful, but
+ *   WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *   FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ *   details.
+ *
+ *   You should have received a copy of the GNU General Public License along
+ *   with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FOCUS_TRACE_H
+#define FOCUS_TRACE_H
+
+#include <stdio.h>
+#include <vector>
+
+#include "focusinfo.h"
+
+/*
+ * A focus event as recorded before filtering, along with the type of the
+ * AT-SPI event it came from.
+ */
+struct FocusTraceEvent
+{
+    FocusInfo   focus;
+    const gchar *eventType;
+};
+
+/*
+ * Appends focus events to a trace file, one line each:
+ *
+ *   arrival time, type, event type, role, application, source, x y w h,
+ *   alternative x y w h and the active/focused/selected flags,
+ *
+ * separated by tabs. Lines starting with '#' are ignored.
+ */
+class FocusTraceWriter
+{
+    public:
+	FocusTraceWriter ();
+	~FocusTraceWriter ();
+
+	bool open (const gchar *path);
+	void close (void);
+	bool isOpen (void) const;
+
+	void write (const FocusInfo &focus, const gchar *eventType,
+		    const FocusStringTable &strings);
+
+    private:
+	FILE *file;
+};
+
+bool readFocusTrace (const gchar *path, FocusStringTable &strings,
+		     std::vector <FocusTraceEvent> &events);
+
+#endif
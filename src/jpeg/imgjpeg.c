@@ -25,14 +25,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <setjmp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <compiz-core.h>
 
 #include <X11/Xarch.h>
 #include <jpeglib.h>
+#include <jerror.h>
 #include "imgjpeg_options.h"
 
+#include "compiz-imgjpeg.h"
+
+#define JPEG_MAX_DECODE_THREADS 4
+#define JPEG_MAX_PREFETCH       32
+
 static int displayPrivateIndex;
+static int functionsPrivateIndex;
 
 struct jpegErrorMgr
 {
@@ -40,10 +53,96 @@ struct jpegErrorMgr
     jmp_buf setjmp_buffer;	/* for return to caller */
 };
 
+typedef struct _JPEGWriteJob JPEGWriteJob;
+
+struct _JPEGWriteJob
+{
+    JPEGWriteJob *next;
+
+    char *fileName;
+    void *data;
+    int  width;
+    int  height;
+    int  stride;
+    int  quality;
+    Bool status;
+
+    ImageWrittenProc written;
+    void             *closure;
+};
+
+typedef struct _JPEGCacheEntry JPEGCacheEntry;
+
+/* decoded image, identified by the file it was loaded from */
+struct _JPEGCacheEntry
+{
+    JPEGCacheEntry *next;
+
+    char   *fileName;
+    time_t mtime;
+    off_t  fileSize;
+    int    targetWidth;
+    int    targetHeight;
+
+    int  width;
+    int  height;
+    void *data;
+};
+
+typedef enum _JPEGPrefetchState
+{
+    JPEGPrefetchPending,
+    JPEGPrefetchDecoding,
+    JPEGPrefetchDone
+} JPEGPrefetchState;
+
+typedef struct _JPEGPrefetch JPEGPrefetch;
+
+/* image decoded ahead of time by the decode threads */
+struct _JPEGPrefetch
+{
+    JPEGPrefetch *next;
+
+    char              *fileName;
+    JPEGPrefetchState state;
+
+    Bool        status;
+    struct stat st;
+    int         width;
+    int         height;
+    void        *data;
+};
+
 typedef struct _JPEGDisplay
 {
     FileToImageProc fileToImage;
     ImageToFileProc imageToFile;
+
+    /* background writing, set up on first use */
+    Bool              writeThreadRunning;
+    pthread_t         writeThread;
+    pthread_mutex_t   writeMutex;
+    pthread_cond_t    writeCond;
+    JPEGWriteJob      *writeQueue;
+    Bool              writeExit;
+    int               writeDonePipe[2];
+    CompWatchFdHandle writeDoneHandle;
+
+    /* most recently used images first */
+    JPEGCacheEntry *cache;
+    size_t         cacheSize;
+
+    /* protects the prefetch list, which is shared with the decode threads,
+       newest first */
+    pthread_mutex_t prefetchMutex;
+    pthread_cond_t  prefetchCond;
+    JPEGPrefetch    *prefetch;
+    int             nPrefetch;
+
+    /* decode threads, started on first use */
+    pthread_t       prefetchThread[JPEG_MAX_DECODE_THREADS];
+    int             prefetchThreads;
+    Bool            prefetchExit;
 } JPEGDisplay;
 
 #define GET_JPEG_DISPLAY(d)				    \
@@ -52,75 +151,43 @@ typedef struct _JPEGDisplay
 #define JPEG_DISPLAY(d)			 \
     JPEGDisplay *jd = GET_JPEG_DISPLAY (d)
 
-static Bool
-rgbToBGRA (const JSAMPLE *source,
-	   void          **data,
-	   int           height,
-	   int           width,
-	   int           alpha)
+#ifndef JCS_EXTENSIONS
+/* Expand a row of RGB samples into the ARGB32 layout used by the core.
+   The samples are expected at the end of the destination row, so that
+   the row can be converted in place without an intermediate buffer. */
+static void
+rgbToARGB (JSAMPLE *row,
+	   int     width)
 {
-    int  h, w;
-    char *dest;
-
-    dest = malloc (height * width * 4);
-    if (!dest)
-	return FALSE;
-
-    *data = dest;
+    unsigned int  *dest = (unsigned int *) row;
+    const JSAMPLE *src = row + width;
+    int           w;
 
-    for (h = 0; h < height; h++)
-	for (w = 0; w < width; w++)
-	{
-	    int pos = h * width + w;
-#if __BYTE_ORDER == __BIG_ENDIAN
-	    dest[(pos * 4) + 3] = source[(pos * 3) + 2];    /* blue */
-	    dest[(pos * 4) + 2] = source[(pos * 3) + 1];    /* green */
-	    dest[(pos * 4) + 1] = source[(pos * 3) + 0];    /* red */
-	    dest[(pos * 4) + 0] = alpha;
-#else
-	    dest[(pos * 4) + 0] = source[(pos * 3) + 2];    /* blue */
-	    dest[(pos * 4) + 1] = source[(pos * 3) + 1];    /* green */
-	    dest[(pos * 4) + 2] = source[(pos * 3) + 0];    /* red */
-	    dest[(pos * 4) + 3] = alpha;
-#endif
-	}
-
-    return TRUE;
+    for (w = 0; w < width; w++, src += 3)
+	dest[w] = 0xff000000 | (src[0] << 16) | (src[1] << 8) | src[2];
 }
+#endif
 
-static Bool
-rgbaToRGB (char    *source,
-	   JSAMPLE **dest,
-	   int     height,
-	   int     width,
-	   int     stride)
-{
-    int     h, w;
-    int     ps = stride / width;	/* pixel size */
-    JSAMPLE *d;
-
-    d = malloc (height * width * 3 * sizeof (JSAMPLE));
-    if (!d)
-	return FALSE;
-
-    *dest = d;
+static void
+rgbaToRGB (const JSAMPLE *source,
+	   JSAMPLE       *dest,
+	   int           width,
+	   int           ps)
+{
+    int w;
 
-    for (h = 0; h < height; h++)
-	for (w = 0; w < width; w++)
-	{
-	    int pos = h * width + w;
+    for (w = 0; w < width; w++, source += ps, dest += 3)
+    {
 #if __BYTE_ORDER == __BIG_ENDIAN
-	    d[(pos * 3) + 0] = source[(pos * ps) + 3];	/* red */
-    	    d[(pos * 3) + 1] = source[(pos * ps) + 2];	/* green */
-    	    d[(pos * 3) + 2] = source[(pos * ps) + 1];	/* blue */
+	dest[0] = source[3];	/* red */
+	dest[1] = source[2];	/* green */
+	dest[2] = source[1];	/* blue */
 #else
-	    d[(pos * 3) + 0] = source[(pos * ps) + 0];	/* red */
-    	    d[(pos * 3) + 1] = source[(pos * ps) + 1];	/* green */
-    	    d[(pos * 3) + 2] = source[(pos * ps) + 2];	/* blue */
+	dest[0] = source[0];	/* red */
+	dest[1] = source[1];	/* green */
+	dest[2] = source[2];	/* blue */
 #endif
-	}
-
-    return TRUE;
+    }
 }
 
 static void
@@ -138,21 +205,113 @@ jpegErrorExit (j_common_ptr cinfo)
     longjmp (err->setjmp_buffer, 1);
 }
 
+/* Pick the smallest DCT scaling factor that still results in an image
+   covering the target size, so that the image is never scaled up later */
+static void
+jpegSetScale (struct jpeg_decompress_struct *cinfo,
+	      int                           targetWidth,
+	      int                           targetHeight)
+{
+    int num;
+
+    if (targetWidth <= 0 && targetHeight <= 0)
+	return;
+
+    for (num = 1; num < 8; num++)
+    {
+	int w = (cinfo->image_width * num + 7) / 8;
+	int h = (cinfo->image_height * num + 7) / 8;
+
+	if (w >= targetWidth && h >= targetHeight)
+	    break;
+    }
+
+    cinfo->scale_num   = num;
+    cinfo->scale_denom = 8;
+}
+
+#if JPEG_LIB_VERSION < 80 && !defined (MEM_SRCDST_SUPPORTED)
+/* Minimal memory source for libjpeg versions without jpeg_mem_src */
+static void
+jpegMemInitSource (j_decompress_ptr cinfo)
+{
+}
+
+static boolean
+jpegMemFillInputBuffer (j_decompress_ptr cinfo)
+{
+    static const JOCTET eoi[2] = { 0xff, JPEG_EOI };
+
+    /* the whole file is in the buffer already, so insert a fake EOI */
+    WARNMS (cinfo, JWRN_JPEG_EOF);
+
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+
+    return TRUE;
+}
+
+static void
+jpegMemSkipInputData (j_decompress_ptr cinfo,
+		      long             numBytes)
+{
+    struct jpeg_source_mgr *src = cinfo->src;
+
+    if (numBytes <= 0)
+	return;
+
+    while (numBytes > (long) src->bytes_in_buffer)
+    {
+	numBytes -= (long) src->bytes_in_buffer;
+	(*src->fill_input_buffer) (cinfo);
+    }
+
+    src->next_input_byte += numBytes;
+    src->bytes_in_buffer -= numBytes;
+}
+
+static void
+jpegMemTermSource (j_decompress_ptr cinfo)
+{
+}
+
+static void
+jpeg_mem_src (j_decompress_ptr cinfo,
+	      unsigned char    *buffer,
+	      unsigned long    size)
+{
+    struct jpeg_source_mgr *src;
+
+    if (!cinfo->src)
+	cinfo->src = (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo,
+						 JPOOL_PERMANENT,
+						 sizeof (struct jpeg_source_mgr));
+
+    src = cinfo->src;
+    src->init_source       = jpegMemInitSource;
+    src->fill_input_buffer = jpegMemFillInputBuffer;
+    src->skip_input_data   = jpegMemSkipInputData;
+    src->resync_to_restart = jpeg_resync_to_restart;
+    src->term_source       = jpegMemTermSource;
+    src->next_input_byte   = buffer;
+    src->bytes_in_buffer   = size;
+}
+#endif
+
 static Bool
-readJPEGFileToImage (FILE *file,
-		     int  *width,
-		     int  *height,
-		     void **data)
+readJPEGBufferToImage (unsigned char *buffer,
+		       size_t        size,
+		       int           targetWidth,
+		       int           targetHeight,
+		       int           *width,
+		       int           *height,
+		       void          **data)
 {
     struct jpeg_decompress_struct cinfo;
     struct jpegErrorMgr           jerr;
-    JSAMPLE                       *buf;
-    JSAMPROW                      *rows;
-    int                           i;
-    Bool                          result;
-
-    if (!file)
-	return FALSE;
+    JSAMPLE * volatile            buf = NULL;
+    JSAMPROW                      row;
+    int                           stride;
 
     cinfo.err = jpeg_std_error (&jerr.pub);
     jerr.pub.error_exit = jpegErrorExit;
@@ -161,75 +320,105 @@ readJPEGFileToImage (FILE *file,
     {
 	/* this is called on decompression errors */
 	jpeg_destroy_decompress (&cinfo);
+	if (buf)
+	    free (buf);
 	return FALSE;
     }
 
     jpeg_create_decompress (&cinfo);
 
-    jpeg_stdio_src (&cinfo, file);
+    jpeg_mem_src (&cinfo, buffer, size);
     
     jpeg_read_header (&cinfo, TRUE);
 
+    jpegSetScale (&cinfo, targetWidth, targetHeight);
+
+#ifdef JCS_EXTENSIONS
+    /* libjpeg-turbo can write our native ARGB32 pixels directly */
+#if __BYTE_ORDER == __BIG_ENDIAN
+    cinfo.out_color_space = JCS_EXT_ARGB;
+#else
+    cinfo.out_color_space = JCS_EXT_BGRA;
+#endif
+#else
     cinfo.out_color_space = JCS_RGB;
+#endif
 
     jpeg_start_decompress (&cinfo);
 
     *height = cinfo.output_height;
     *width = cinfo.output_width;
 
-    buf = calloc (cinfo.output_height * cinfo.output_width *
- 		  cinfo.output_components, sizeof (JSAMPLE));
+    stride = cinfo.output_width * 4;
+
+    buf = malloc (cinfo.output_height * stride);
     if (!buf)
     {
-	jpeg_finish_decompress (&cinfo);
 	jpeg_destroy_decompress (&cinfo);
 	return FALSE;
     }
 
-    rows = malloc (cinfo.output_height * sizeof (JSAMPROW));
-    if (!rows)
+    while (cinfo.output_scanline < cinfo.output_height)
     {
-	free (buf);
-	jpeg_finish_decompress (&cinfo);
-	jpeg_destroy_decompress (&cinfo);
-	return FALSE;
-    }
+	row = &buf[cinfo.output_scanline * stride];
 
-    for (i = 0; i < cinfo.output_height; i++)
-	rows[i] = &buf[i * cinfo.output_width * cinfo.output_components];
-
-    while (cinfo.output_scanline < cinfo.output_height)
-	jpeg_read_scanlines (&cinfo, &rows[cinfo.output_scanline],
-			     cinfo.output_height - cinfo.output_scanline);
+#ifdef JCS_EXTENSIONS
+	jpeg_read_scanlines (&cinfo, &row, 1);
+#else
+	/* decode to the end of the row and expand it from the front */
+	row += cinfo.output_width;
+	jpeg_read_scanlines (&cinfo, &row, 1);
+	rgbToARGB (row - cinfo.output_width, cinfo.output_width);
+#endif
+    }
 
     jpeg_finish_decompress (&cinfo);
     jpeg_destroy_decompress (&cinfo);
 
-    /* convert the rgb data into BGRA format */
-    result = rgbToBGRA (buf, data, *height, *width, 255);
+    *data = buf;
 
-    free (rows);
-    free(buf);
-    return result;
+    return TRUE;
 }
 
 static Bool
-writeJPEG (CompDisplay *d,
-	   void        *buffer,
-	   FILE        *file,
-	   int         width,
-	   int         height,
-	   int         stride)
+writeJPEG (void *buffer,
+	   FILE *file,
+	   int  width,
+	   int  height,
+	   int  stride,
+	   int  quality)
 {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr       jerr;
-    JSAMPROW                    row_pointer[1];
-    JSAMPLE                     *data;
+    JSAMPROW                    *rows;
+    JSAMPLE                     *rgb = NULL;
+    int                         ps = stride / width;	/* pixel size */
+    int                         h;
+    Bool                        direct = FALSE;
+
+#ifdef JCS_EXTENSIONS
+    /* libjpeg-turbo can read our pixels without converting them first */
+    direct = (ps == 4);
+#endif
 
-    /* convert the rgb data into BGRA format */
-    if (!rgbaToRGB (buffer, &data, height, width, stride))
+    /* the image is stored bottom-up, flip it through the row pointers */
+    rows = malloc (height * sizeof (JSAMPROW));
+    if (!rows)
 	return FALSE;
 
+    for (h = 0; h < height; h++)
+	rows[h] = (JSAMPROW) buffer + (height - h - 1) * stride;
+
+    if (!direct)
+    {
+	rgb = malloc (width * 3 * sizeof (JSAMPLE));
+	if (!rgb)
+	{
+	    free (rows);
+	    return FALSE;
+	}
+    }
+
     cinfo.err = jpeg_std_error (&jerr);
     jpeg_create_compress (&cinfo);
 
@@ -240,21 +429,42 @@ writeJPEG (CompDisplay *d,
     cinfo.input_components = 3;
     cinfo.in_color_space   = JCS_RGB;
 
+#ifdef JCS_EXTENSIONS
+    if (direct)
+    {
+	cinfo.input_components = 4;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	cinfo.in_color_space   = JCS_EXT_XBGR;
+#else
+	cinfo.in_color_space   = JCS_EXT_RGBX;
+#endif
+    }
+#endif
+
     jpeg_set_defaults (&cinfo);
-    jpeg_set_quality (&cinfo, imgjpegGetQuality (d), TRUE);
+    jpeg_set_quality (&cinfo, quality, TRUE);
     jpeg_start_compress (&cinfo, TRUE);
 
     while (cinfo.next_scanline < cinfo.image_height)
     {
-	row_pointer[0] =
-	    &data[(cinfo.image_height - cinfo.next_scanline - 1) * width * 3];
-	jpeg_write_scanlines (&cinfo, row_pointer, 1);
+	if (direct)
+	{
+	    jpeg_write_scanlines (&cinfo, &rows[cinfo.next_scanline],
+				  cinfo.image_height - cinfo.next_scanline);
+	}
+	else
+	{
+	    rgbaToRGB (rows[cinfo.next_scanline], rgb, width, ps);
+	    jpeg_write_scanlines (&cinfo, &rgb, 1);
+	}
     }
 
     jpeg_finish_compress (&cinfo);
     jpeg_destroy_compress (&cinfo);
 
-    free (data);
+    if (rgb)
+	free (rgb);
+    free (rows);
 
     return TRUE;
 }
@@ -286,6 +496,211 @@ createFilename (const char *path,
     return filename;
 }
 
+static Bool
+writeJPEGFile (const char *fileName,
+	       void       *data,
+	       int        width,
+	       int        height,
+	       int        stride,
+	       int        quality)
+{
+    Bool status = FALSE;
+    FILE *file;
+
+    file = fopen (fileName, "wb");
+    if (file)
+    {
+	status = writeJPEG (data, file, width, height, stride, quality);
+	fclose (file);
+    }
+
+    return status;
+}
+
+static void
+freeWriteJob (JPEGWriteJob *job)
+{
+    free (job->fileName);
+    free (job->data);
+    free (job);
+}
+
+/* Runs in the write thread, takes jobs off the queue until the
+   display goes away. The queue is always emptied before exiting. */
+static void *
+jpegWriteThread (void *closure)
+{
+    JPEGDisplay  *jd = closure;
+    JPEGWriteJob *job;
+
+    for (;;)
+    {
+	pthread_mutex_lock (&jd->writeMutex);
+
+	while (!jd->writeQueue && !jd->writeExit)
+	    pthread_cond_wait (&jd->writeCond, &jd->writeMutex);
+
+	job = jd->writeQueue;
+	if (job)
+	    jd->writeQueue = job->next;
+
+	pthread_mutex_unlock (&jd->writeMutex);
+
+	if (!job)
+	    break;
+
+	job->status = writeJPEGFile (job->fileName, job->data, job->width,
+				     job->height, job->stride, job->quality);
+
+	/* hand the job back to the main thread */
+	if (write (jd->writeDonePipe[1], &job, sizeof (job)) != sizeof (job))
+	    freeWriteJob (job);
+    }
+
+    return NULL;
+}
+
+static Bool
+jpegWriteDone (void *closure)
+{
+    CompDisplay  *d = closure;
+    JPEGWriteJob *job;
+
+    JPEG_DISPLAY (d);
+
+    while (read (jd->writeDonePipe[0], &job, sizeof (job)) == sizeof (job))
+    {
+	if (!job->status)
+	    compLogMessage ("imgjpeg", CompLogLevelError,
+			    "Couldn't write image to %s.", job->fileName);
+
+	if (job->written)
+	    (*job->written) (d, job->fileName, job->status, job->closure);
+
+	freeWriteJob (job);
+    }
+
+    return TRUE;
+}
+
+static Bool
+jpegStartWriteThread (CompDisplay *d)
+{
+    JPEG_DISPLAY (d);
+
+    if (jd->writeThreadRunning)
+	return TRUE;
+
+    if (pipe (jd->writeDonePipe) < 0)
+	return FALSE;
+
+    fcntl (jd->writeDonePipe[0], F_SETFL, O_NONBLOCK);
+
+    jd->writeQueue = NULL;
+    jd->writeExit  = FALSE;
+
+    pthread_mutex_init (&jd->writeMutex, NULL);
+    pthread_cond_init (&jd->writeCond, NULL);
+
+    if (pthread_create (&jd->writeThread, NULL, jpegWriteThread, jd) != 0)
+    {
+	pthread_cond_destroy (&jd->writeCond);
+	pthread_mutex_destroy (&jd->writeMutex);
+	close (jd->writeDonePipe[0]);
+	close (jd->writeDonePipe[1]);
+	return FALSE;
+    }
+
+    jd->writeDoneHandle = compAddWatchFd (jd->writeDonePipe[0], POLLIN,
+					  jpegWriteDone, d);
+    jd->writeThreadRunning = TRUE;
+
+    return TRUE;
+}
+
+static void
+jpegStopWriteThread (CompDisplay *d)
+{
+    JPEGWriteJob *job;
+
+    JPEG_DISPLAY (d);
+
+    if (!jd->writeThreadRunning)
+	return;
+
+    /* let the thread finish all pending writes */
+    pthread_mutex_lock (&jd->writeMutex);
+    jd->writeExit = TRUE;
+    pthread_cond_signal (&jd->writeCond);
+    pthread_mutex_unlock (&jd->writeMutex);
+
+    pthread_join (jd->writeThread, NULL);
+
+    compRemoveWatchFd (jd->writeDoneHandle);
+
+    /* the clients may be gone already, so don't notify them anymore */
+    while (read (jd->writeDonePipe[0], &job, sizeof (job)) == sizeof (job))
+	freeWriteJob (job);
+
+    close (jd->writeDonePipe[0]);
+    close (jd->writeDonePipe[1]);
+
+    pthread_cond_destroy (&jd->writeCond);
+    pthread_mutex_destroy (&jd->writeMutex);
+
+    jd->writeThreadRunning = FALSE;
+}
+
+static Bool
+JPEGImageToFileAsync (CompDisplay      *d,
+		      const char       *path,
+		      const char       *name,
+		      int              width,
+		      int              height,
+		      int              stride,
+		      void             *data,
+		      ImageWrittenProc written,
+		      void             *closure)
+{
+    JPEGWriteJob *job, **tail;
+
+    JPEG_DISPLAY (d);
+
+    if (!jpegStartWriteThread (d))
+	return FALSE;
+
+    job = malloc (sizeof (JPEGWriteJob));
+    if (!job)
+	return FALSE;
+
+    job->fileName = createFilename (path, name);
+    if (!job->fileName)
+    {
+	free (job);
+	return FALSE;
+    }
+
+    job->next     = NULL;
+    job->data     = data;
+    job->width    = width;
+    job->height   = height;
+    job->stride   = stride;
+    job->quality  = imgjpegGetQuality (d);
+    job->status   = FALSE;
+    job->written  = written;
+    job->closure  = closure;
+
+    pthread_mutex_lock (&jd->writeMutex);
+
+    for (tail = &jd->writeQueue; *tail; tail = &(*tail)->next);
+    *tail = job;
+
+    pthread_cond_signal (&jd->writeCond);
+    pthread_mutex_unlock (&jd->writeMutex);
+
+    return TRUE;
+}
+
 static Bool
 JPEGImageToFile (CompDisplay *d,
 		 const char  *path,
@@ -298,7 +713,6 @@ JPEGImageToFile (CompDisplay *d,
 {
     Bool status = FALSE;
     char *fileName;
-    FILE *file;
 
     /* Not a JPEG */
     if (strcasecmp (format, "jpeg") != 0 && strcasecmp (format, "jpg") != 0)
@@ -312,18 +726,512 @@ JPEGImageToFile (CompDisplay *d,
     }
 
     /* Is a JPEG */
+    if (imgjpegGetAsyncWrite (d))
+    {
+	void *copy;
+
+	/* the caller keeps ownership of the data, so copy it */
+	copy = malloc (height * stride);
+	if (copy)
+	{
+	    memcpy (copy, data, height * stride);
+	    if (JPEGImageToFileAsync (d, path, name, width, height, stride,
+				      copy, NULL, NULL))
+		return TRUE;
+
+	    free (copy);
+	}
+    }
+
     fileName = createFilename (path, name);
     if (!fileName)
 	return FALSE;
 
-    file = fopen (fileName, "wb");
-    if (file)
+    status = writeJPEGFile (fileName, data, width, height, stride,
+			    imgjpegGetQuality (d));
+
+    free (fileName);
+    return status;
+}
+
+static void
+freeCacheEntry (JPEGCacheEntry *entry)
+{
+    free (entry->fileName);
+    free (entry->data);
+    free (entry);
+}
+
+static void
+jpegFlushCache (CompDisplay *d)
+{
+    JPEGCacheEntry *entry;
+
+    JPEG_DISPLAY (d);
+
+    while (jd->cache)
     {
-	status = writeJPEG (d, data, file, width, height, stride);
-	fclose (file);
+	entry = jd->cache;
+	jd->cache = entry->next;
+	freeCacheEntry (entry);
+    }
+
+    jd->cacheSize = 0;
+}
+
+static JPEGCacheEntry *
+jpegFindCacheEntry (CompDisplay *d,
+		    const char  *fileName,
+		    struct stat *st,
+		    int         targetWidth,
+		    int         targetHeight)
+{
+    JPEGCacheEntry *entry, **prev;
+
+    JPEG_DISPLAY (d);
+
+    for (prev = &jd->cache; *prev; prev = &(*prev)->next)
+    {
+	entry = *prev;
+
+	if (entry->mtime        == st->st_mtime  &&
+	    entry->fileSize     == st->st_size   &&
+	    entry->targetWidth  == targetWidth   &&
+	    entry->targetHeight == targetHeight  &&
+	    strcmp (entry->fileName, fileName) == 0)
+	{
+	    /* move it to the front */
+	    *prev = entry->next;
+	    entry->next = jd->cache;
+	    jd->cache = entry;
+
+	    return entry;
+	}
+    }
+
+    return NULL;
+}
+
+static void
+jpegAddCacheEntry (CompDisplay *d,
+		   const char  *fileName,
+		   struct stat *st,
+		   int         targetWidth,
+		   int         targetHeight,
+		   int         width,
+		   int         height,
+		   const void  *data)
+{
+    JPEGCacheEntry *entry, **prev;
+    size_t         size, maxSize;
+
+    JPEG_DISPLAY (d);
+
+    size    = (size_t) width * height * 4;
+    maxSize = (size_t) imgjpegGetCacheSize (d) * 1024 * 1024;
+
+    if (size > maxSize)
+	return;
+
+    /* drop the least recently used images until the new one fits */
+    while (jd->cache && jd->cacheSize + size > maxSize)
+    {
+	for (prev = &jd->cache; (*prev)->next; prev = &(*prev)->next);
+
+	entry = *prev;
+	*prev = NULL;
+
+	jd->cacheSize -= (size_t) entry->width * entry->height * 4;
+	freeCacheEntry (entry);
+    }
+
+    entry = malloc (sizeof (JPEGCacheEntry));
+    if (!entry)
+	return;
+
+    entry->fileName = strdup (fileName);
+    entry->data     = malloc (size);
+    if (!entry->fileName || !entry->data)
+    {
+	free (entry->fileName);
+	free (entry->data);
+	free (entry);
+	return;
+    }
+
+    memcpy (entry->data, data, size);
+
+    entry->mtime        = st->st_mtime;
+    entry->fileSize     = st->st_size;
+    entry->targetWidth  = targetWidth;
+    entry->targetHeight = targetHeight;
+    entry->width        = width;
+    entry->height       = height;
+
+    entry->next = jd->cache;
+    jd->cache = entry;
+    jd->cacheSize += size;
+}
+
+static Bool
+isJPEGFileName (const char *fileName)
+{
+    char *extension;
+
+    /* Do some testing here to see if it's got a .jpg or .jpeg extension */
+    extension = strrchr (fileName, '.');
+    if (!extension)
+	return FALSE;
+
+    return (strcasecmp (extension, ".jpeg") == 0 ||
+	    strcasecmp (extension, ".jpg") == 0);
+}
+
+/* Safe to be called from the decode threads */
+static Bool
+decodeJPEGFile (int         fd,
+		struct stat *st,
+		int         targetWidth,
+		int         targetHeight,
+		int         *width,
+		int         *height,
+		void        **data)
+{
+    void *map;
+    Bool status;
+
+    map = mmap (NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+	return FALSE;
+
+    status = readJPEGBufferToImage (map, st->st_size, targetWidth, targetHeight,
+				    width, height, data);
+
+    munmap (map, st->st_size);
+
+    return status;
+}
+
+static void
+freePrefetch (JPEGPrefetch *prefetch)
+{
+    free (prefetch->fileName);
+    if (prefetch->data)
+	free (prefetch->data);
+    free (prefetch);
+}
+
+static void *
+jpegDecodeThread (void *closure)
+{
+    JPEGDisplay  *jd = closure;
+    JPEGPrefetch *prefetch;
+    int          fd;
+
+    pthread_mutex_lock (&jd->prefetchMutex);
+
+    while (!jd->prefetchExit)
+    {
+	for (prefetch = jd->prefetch; prefetch; prefetch = prefetch->next)
+	    if (prefetch->state == JPEGPrefetchPending)
+		break;
+
+	/* nothing left to do until new images are prefetched */
+	if (!prefetch)
+	{
+	    pthread_cond_wait (&jd->prefetchCond, &jd->prefetchMutex);
+	    continue;
+	}
+
+	prefetch->state = JPEGPrefetchDecoding;
+	pthread_mutex_unlock (&jd->prefetchMutex);
+
+	prefetch->status = FALSE;
+
+	fd = open (prefetch->fileName, O_RDONLY);
+	if (fd >= 0)
+	{
+	    if (fstat (fd, &prefetch->st) == 0 && prefetch->st.st_size > 0)
+		prefetch->status = decodeJPEGFile (fd, &prefetch->st, 0, 0,
+						   &prefetch->width,
+						   &prefetch->height,
+						   &prefetch->data);
+	    close (fd);
+	}
+
+	pthread_mutex_lock (&jd->prefetchMutex);
+	prefetch->state = JPEGPrefetchDone;
+	pthread_cond_broadcast (&jd->prefetchCond);
+    }
+
+    pthread_mutex_unlock (&jd->prefetchMutex);
+
+    return NULL;
+}
+
+/* Takes the prefetched image for fileName out of the list, waiting
+   for it to be decoded if a thread is at it already. An image no thread
+   got to yet is dropped and decoded by the caller instead, so there is
+   no waiting for a thread that may never come */
+static JPEGPrefetch *
+jpegTakePrefetch (CompDisplay *d,
+		  const char  *fileName)
+{
+    JPEGPrefetch *prefetch, **prev;
+
+    JPEG_DISPLAY (d);
+
+    pthread_mutex_lock (&jd->prefetchMutex);
+
+    for (prev = &jd->prefetch; *prev; prev = &(*prev)->next)
+	if (strcmp ((*prev)->fileName, fileName) == 0)
+	    break;
+
+    prefetch = *prev;
+    if (prefetch)
+    {
+	while (prefetch->state == JPEGPrefetchDecoding)
+	    pthread_cond_wait (&jd->prefetchCond, &jd->prefetchMutex);
+
+	/* the list may have changed while waiting */
+	for (prev = &jd->prefetch; *prev != prefetch; prev = &(*prev)->next);
+	*prev = prefetch->next;
+	jd->nPrefetch--;
+
+	if (prefetch->state == JPEGPrefetchPending)
+	{
+	    freePrefetch (prefetch);
+	    prefetch = NULL;
+	}
+    }
+
+    pthread_mutex_unlock (&jd->prefetchMutex);
+
+    return prefetch;
+}
+
+/* Makes room for another image by dropping the oldest one that is not
+   being decoded, images nobody took are not kept around forever */
+static Bool
+jpegTrimPrefetch (JPEGDisplay *jd)
+{
+    JPEGPrefetch *p, **prev, **oldest = NULL;
+
+    if (jd->nPrefetch < JPEG_MAX_PREFETCH)
+	return TRUE;
+
+    for (prev = &jd->prefetch; *prev; prev = &(*prev)->next)
+	if ((*prev)->state != JPEGPrefetchDecoding)
+	    oldest = prev;
+
+    if (!oldest)
+	return FALSE;
+
+    p = *oldest;
+    *oldest = p->next;
+    jd->nPrefetch--;
+
+    freePrefetch (p);
+
+    return TRUE;
+}
+
+static void
+JPEGPrefetchImages (CompDisplay *d,
+		    const char  *path,
+		    const char  **names,
+		    int         nNames)
+{
+    JPEGPrefetch *prefetch, *p;
+    int          i, maxThreads;
+
+    JPEG_DISPLAY (d);
+
+    maxThreads = sysconf (_SC_NPROCESSORS_ONLN);
+    maxThreads = MAX (1, MIN (maxThreads, JPEG_MAX_DECODE_THREADS));
+
+    pthread_mutex_lock (&jd->prefetchMutex);
+
+    for (i = 0; i < nNames; i++)
+    {
+	prefetch = calloc (1, sizeof (JPEGPrefetch));
+	if (!prefetch)
+	    break;
+
+	prefetch->fileName = createFilename (path, names[i]);
+	if (!prefetch->fileName || !isJPEGFileName (prefetch->fileName))
+	{
+	    freePrefetch (prefetch);
+	    continue;
+	}
+
+	for (p = jd->prefetch; p; p = p->next)
+	    if (strcmp (p->fileName, prefetch->fileName) == 0)
+		break;
+
+	if (p || !jpegTrimPrefetch (jd))
+	{
+	    freePrefetch (prefetch);
+	    continue;
+	}
+
+	prefetch->state = JPEGPrefetchPending;
+	prefetch->next  = jd->prefetch;
+	jd->prefetch    = prefetch;
+	jd->nPrefetch++;
+
+	if (jd->prefetchThreads < maxThreads &&
+	    pthread_create (&jd->prefetchThread[jd->prefetchThreads], NULL,
+			    jpegDecodeThread, jd) == 0)
+	    jd->prefetchThreads++;
+    }
+
+    pthread_cond_broadcast (&jd->prefetchCond);
+    pthread_mutex_unlock (&jd->prefetchMutex);
+}
+
+static void
+jpegFiniPrefetch (CompDisplay *d)
+{
+    JPEGPrefetch *prefetch;
+    int          i;
+
+    JPEG_DISPLAY (d);
+
+    /* don't start any new decodes and wait for the running ones */
+    pthread_mutex_lock (&jd->prefetchMutex);
+    jd->prefetchExit = TRUE;
+    pthread_cond_broadcast (&jd->prefetchCond);
+    pthread_mutex_unlock (&jd->prefetchMutex);
+
+    for (i = 0; i < jd->prefetchThreads; i++)
+	pthread_join (jd->prefetchThread[i], NULL);
+
+    while (jd->prefetch)
+    {
+	prefetch = jd->prefetch;
+	jd->prefetch = prefetch->next;
+	freePrefetch (prefetch);
+    }
+
+    pthread_cond_destroy (&jd->prefetchCond);
+    pthread_mutex_destroy (&jd->prefetchMutex);
+}
+
+static Bool
+readJPEGFile (CompDisplay *d,
+	      const char  *fileName,
+	      int         targetWidth,
+	      int         targetHeight,
+	      int         *width,
+	      int         *height,
+	      void        **data)
+{
+    JPEGCacheEntry *entry;
+    JPEGPrefetch   *prefetch = NULL;
+    struct stat    st;
+    int            fd;
+    Bool           status;
+
+    if (!targetWidth && !targetHeight)
+	prefetch = jpegTakePrefetch (d, fileName);
+
+    fd = open (fileName, O_RDONLY);
+    if (fd < 0)
+    {
+	if (prefetch)
+	    freePrefetch (prefetch);
+	return FALSE;
+    }
+
+    if (fstat (fd, &st) < 0 || st.st_size <= 0)
+    {
+	if (prefetch)
+	    freePrefetch (prefetch);
+	close (fd);
+	return FALSE;
+    }
+
+    /* use the prefetched image if the file hasn't changed since */
+    if (prefetch)
+    {
+	if (prefetch->status                           &&
+	    prefetch->st.st_mtime == st.st_mtime       &&
+	    prefetch->st.st_size  == st.st_size)
+	{
+	    close (fd);
+
+	    *width  = prefetch->width;
+	    *height = prefetch->height;
+	    *data   = prefetch->data;
+
+	    prefetch->data = NULL;
+	    freePrefetch (prefetch);
+
+	    jpegAddCacheEntry (d, fileName, &st, 0, 0, *width, *height, *data);
+
+	    return TRUE;
+	}
+
+	freePrefetch (prefetch);
     }
 
+    /* the caller owns the returned data, so hand out a copy */
+    entry = jpegFindCacheEntry (d, fileName, &st, targetWidth, targetHeight);
+    if (entry)
+    {
+	close (fd);
+
+	*data = malloc ((size_t) entry->width * entry->height * 4);
+	if (!*data)
+	    return FALSE;
+
+	memcpy (*data, entry->data, (size_t) entry->width * entry->height * 4);
+	*width  = entry->width;
+	*height = entry->height;
+
+	return TRUE;
+    }
+
+    status = decodeJPEGFile (fd, &st, targetWidth, targetHeight,
+			     width, height, data);
+    close (fd);
+
+    if (status)
+	jpegAddCacheEntry (d, fileName, &st, targetWidth, targetHeight,
+			   *width, *height, *data);
+
+    return status;
+}
+
+static Bool
+loadJPEGFile (CompDisplay *d,
+	      const char  *path,
+	      const char  *name,
+	      int         targetWidth,
+	      int         targetHeight,
+	      int         *width,
+	      int         *height,
+	      int         *stride,
+	      void        **data)
+{
+    Bool status = FALSE;
+    char *fileName;
+
+    fileName = createFilename (path, name);
+    if (!fileName)
+	return FALSE;
+
+    if (isJPEGFileName (fileName))
+    {
+	status = readJPEGFile (d, fileName, targetWidth, targetHeight,
+			       width, height, data);
+
+	if (status)		/* Success! */
+	    *stride = *width * 4;
+    }
     free (fileName);
+
     return status;
 }
 
@@ -336,40 +1244,12 @@ JPEGFileToImage (CompDisplay *d,
 		 int         *stride,
 		 void        **data)
 {
-    Bool status = FALSE;
-    char *fileName, *extension;
+    Bool status;
 
     JPEG_DISPLAY (d);
 
-    fileName = createFilename (path, name);
-    if (!fileName)
-	return FALSE;
-
-    /* Do some testing here to see if it's got a .jpg or .jpeg extension */
-    extension = strrchr (fileName, '.');
-    if (extension)
-    {
-	if (strcasecmp (extension, ".jpeg") == 0 ||
-	    strcasecmp (extension, ".jpg") == 0)
-	{
-	    FILE *file;
-
-	    file = fopen (fileName, "rb");
-	    if (file)
-	    {
-		status = readJPEGFileToImage (file, width, height, data);
-		fclose (file);
-
-		if (status)		/* Success! */
-		{
-		    free (fileName);
-    		    *stride = *width * 4;
-		    return TRUE;
-		}
-	    }
-	}
-    }
-    free (fileName);
+    if (loadJPEGFile (d, path, name, 0, 0, width, height, stride, data))
+	return TRUE;
 
     /* Isn't a JPEG - pass to the next in the chain. */
     UNWRAP (jd, d, fileToImage);
@@ -379,6 +1259,34 @@ JPEGFileToImage (CompDisplay *d,
     return status;
 }
 
+static Bool
+JPEGFileToImageScaled (CompDisplay *d,
+		       const char  *path,
+		       const char  *name,
+		       int         targetWidth,
+		       int         targetHeight,
+		       int         *width,
+		       int         *height,
+		       int         *stride,
+		       void        **data)
+{
+    if (loadJPEGFile (d, path, name, targetWidth, targetHeight,
+		      width, height, stride, data))
+	return TRUE;
+
+    /* other formats can't be scaled while loading. This isn't part of
+       the wrap chain, so go through all of it, including the image
+       plugins loaded after us. */
+    return (*d->fileToImage) (d, path, name, width, height, stride, data);
+}
+
+static ImgJpegFunc jpegFunctions =
+{
+    .fileToImageScaled = JPEGFileToImageScaled,
+    .imageToFileAsync  = JPEGImageToFileAsync,
+    .prefetchImages    = JPEGPrefetchImages
+};
+
 static Bool
 JPEGInitDisplay (CompPlugin  *p,
 		 CompDisplay *d)
@@ -392,10 +1300,28 @@ JPEGInitDisplay (CompPlugin  *p,
     if (!jd)
 	return FALSE;
 
+    jd->writeThreadRunning = FALSE;
+
+    jd->cache     = NULL;
+    jd->cacheSize = 0;
+
+    pthread_mutex_init (&jd->prefetchMutex, NULL);
+    pthread_cond_init (&jd->prefetchCond, NULL);
+    jd->prefetch        = NULL;
+    jd->nPrefetch       = 0;
+    jd->prefetchThreads = 0;
+    jd->prefetchExit    = FALSE;
+
     WRAP (jd, d, fileToImage, JPEGFileToImage);
     WRAP (jd, d, imageToFile, JPEGImageToFile);
 
-    d->base.privates[displayPrivateIndex].ptr = jd;
+    imgjpegGetDisplayOption (d, ImgjpegDisplayOptionAbi)->value.i =
+	IMGJPEG_ABIVERSION;
+    imgjpegGetDisplayOption (d, ImgjpegDisplayOptionIndex)->value.i =
+	functionsPrivateIndex;
+
+    d->base.privates[displayPrivateIndex].ptr   = jd;
+    d->base.privates[functionsPrivateIndex].ptr = &jpegFunctions;
 
     return TRUE;
 }
@@ -406,6 +1332,10 @@ JPEGFiniDisplay (CompPlugin  *p,
 {
     JPEG_DISPLAY (d);
 
+    jpegStopWriteThread (d);
+    jpegFiniPrefetch (d);
+    jpegFlushCache (d);
+
     UNWRAP (jd, d, fileToImage);
     UNWRAP (jd, d, imageToFile);
 
@@ -443,6 +1373,13 @@ JPEGInit (CompPlugin *p)
     if (displayPrivateIndex < 0)
 	return FALSE;
 
+    functionsPrivateIndex = allocateDisplayPrivateIndex ();
+    if (functionsPrivateIndex < 0)
+    {
+	freeDisplayPrivateIndex (displayPrivateIndex);
+	return FALSE;
+    }
+
     return TRUE;
 }
 
@@ -450,6 +1387,7 @@ static void
 JPEGFini (CompPlugin *p)
 {
     freeDisplayPrivateIndex (displayPrivateIndex);
+    freeDisplayPrivateIndex (functionsPrivateIndex);
 }
 
 CompPluginVTable JPEGVTable = {
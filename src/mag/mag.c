@@ -86,6 +86,7 @@ typedef struct _MagScreen
     GLuint program;
 
     PositionPollingHandle pollHandle;
+    Bool                  predicting;
 	
     PreparePaintScreenProc preparePaintScreen;
     DonePaintScreenProc    donePaintScreen;
@@ -414,6 +415,15 @@ magPreparePaintScreen (CompScreen *s,
 	    ms->pollHandle =
 		(*md->mpFunc->addPositionPolling) (s, positionUpdate);
 	}
+	else
+	{
+	    /* draw where the pointer is going to be when this frame
+	       is shown */
+	    damageRegion (s);
+	    ms->predicting =
+		(*md->mpFunc->getPredictedPosition) (s, s->redrawTime,
+						     &ms->posX, &ms->posY);
+	}
 	damageRegion (s);
     }
 
@@ -428,7 +438,8 @@ magDonePaintScreen (CompScreen *s)
     MAG_SCREEN (s);
     MAG_DISPLAY (s->display);
 
-    if (ms->adjust)
+    /* keep painting until the prediction settles on the real position */
+    if (ms->adjust || ms->predicting)
 	damageRegion (s);
 
     if (!ms->adjust && ms->zoom == 1.0 && (ms->width || ms->height))
@@ -452,6 +463,7 @@ magDonePaintScreen (CompScreen *s)
     {
 	(*md->mpFunc->removePositionPolling) (s, ms->pollHandle);
 	ms->pollHandle = 0;
+	ms->predicting = FALSE;
     }
 
     UNWRAP (ms, s, donePaintScreen);
@@ -1098,6 +1110,7 @@ magInitScreen (CompPlugin *p,
     ms->zTarget = 1.0;
 
     ms->pollHandle = 0;
+    ms->predicting = FALSE;
 
     glGenTextures (1, &ms->texture);
 
@@ -20,9 +20,18 @@
  *
  */
 
+#include <config.h>
+
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
 #include <compiz-core.h>
 
+#ifdef HAVE_XI2
+#include <X11/extensions/XInput2.h>
+#endif
+
 #include "compiz-mousepoll.h"
 
 static CompMetadata mousepollMetadata;
@@ -30,6 +39,18 @@ static CompMetadata mousepollMetadata;
 static int displayPrivateIndex;
 static int functionsPrivateIndex;
 
+/* maximum factor the poll interval grows to while the pointer is still */
+#define MOUSEPOLL_MAX_BACKOFF 8
+
+/* number of timestamped positions kept for prediction */
+#define MOUSEPOLL_HISTORY_SIZE 16
+
+/* time span in ms used to estimate the pointer velocity */
+#define MOUSEPOLL_VELOCITY_WINDOW 50
+
+/* maximum time in ms a position is extrapolated ahead */
+#define MOUSEPOLL_MAX_PREDICTION 50
+
 typedef struct _MousepollClient MousepollClient;
 
 struct _MousepollClient {
@@ -38,8 +59,18 @@ struct _MousepollClient {
 
     PositionPollingHandle id;
     PositionUpdateProc    update;
+
+    int            interval; /* requested interval in ms */
+    Bool           pending;
+    struct timeval lastUpdate;
 };
 
+typedef struct _MousepollSample {
+    int            x;
+    int            y;
+    struct timeval time;
+} MousepollSample;
+
 typedef enum _MousepollDisplayOptions
 {
     MP_DISPLAY_OPTION_ABI,
@@ -51,6 +82,13 @@ typedef enum _MousepollDisplayOptions
 typedef struct _MousepollDisplay {
     int	screenPrivateIndex;
 
+#ifdef HAVE_XI2
+    HandleEventProc handleEvent;
+
+    Bool xi2;
+    int  xiOpcode;
+#endif
+
     CompOption opt[MP_DISPLAY_OPTION_NUM];
 } MousepollDisplay;
 
@@ -60,10 +98,26 @@ typedef struct _MousepollScreen {
     PositionPollingHandle freeId;
 
     CompTimeoutHandle updateHandle;
+    Bool              inUpdate;     /* updatePosition is notifying clients */
+    int               interval;     /* fastest interval requested */
+    int               pollInterval; /* current, backed off interval */
+
+#ifdef HAVE_XI2
+    /* pointer position is tracked from XI2 events instead of the timer */
+    Bool              xiSelected;
+    CompTimeoutHandle eventHandle;
+    struct timeval    lastQuery;
+#endif
+
     int posX;
     int posY;
     unsigned int buttons;
 
+    /* ring buffer of recent positions, history[historyHead] is newest */
+    MousepollSample history[MOUSEPOLL_HISTORY_SIZE];
+    int             historyHead;
+    int             historyCount;
+
 } MousepollScreen;
 
 #define GET_MOUSEPOLL_DISPLAY(d)				      \
@@ -80,6 +134,26 @@ typedef struct _MousepollScreen {
 
 #define NUM_OPTIONS(s) (sizeof ((s)->opt) / sizeof (CompOption))
 
+static void
+addHistorySample (CompScreen *s,
+		  int        x,
+		  int        y)
+{
+    MousepollSample *sample;
+
+    MOUSEPOLL_SCREEN (s);
+
+    ms->historyHead = (ms->historyHead + 1) % MOUSEPOLL_HISTORY_SIZE;
+    if (ms->historyCount < MOUSEPOLL_HISTORY_SIZE)
+	ms->historyCount++;
+
+    sample = &ms->history[ms->historyHead];
+
+    sample->x = x;
+    sample->y = y;
+    gettimeofday (&sample->time, 0);
+}
+
 static Bool
 getMousePosition (CompScreen *s)
 {
@@ -112,6 +186,7 @@ getMousePosition (CompScreen *s)
     {
 	ms->posX = rootX;
 	ms->posY = rootY;
+	addHistorySample (s, rootX, rootY);
 	return TRUE;
     }
 
@@ -124,37 +199,367 @@ getMousePosition (CompScreen *s)
     return FALSE;
 }
 
+static int
+getTimeDiff (struct timeval *tv,
+	     struct timeval *last)
+{
+    long long diff;
+
+    diff = (long long) (tv->tv_sec - last->tv_sec) * 1000 +
+	   (tv->tv_usec - last->tv_usec) / 1000;
+
+    return MAX (0, MIN (diff, 0x7fffffff));
+}
+
+static double
+getPreciseTimeDiff (struct timeval *tv,
+		    struct timeval *last)
+{
+    return (tv->tv_sec - last->tv_sec) * 1000.0 +
+	   (tv->tv_usec - last->tv_usec) / 1000.0;
+}
+
+static int
+getClientInterval (CompDisplay     *d,
+		   MousepollClient *mc)
+{
+    MOUSEPOLL_DISPLAY (d);
+
+    /* clients may ask for less frequent updates, but never for more
+       frequent ones than configured */
+    return MAX (mc->interval,
+		md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i);
+}
+
+/* Passes the current position to every client whose interval has
+   passed. Returns the time in ms until the next client with an
+   undelivered update is due, or -1 if there is none. */
+static int
+notifyClients (CompScreen *s,
+	       Bool       changed)
+{
+    MousepollClient *mc, *next;
+    struct timeval  tv;
+    int             interval, elapsed, wait = -1;
+
+    MOUSEPOLL_SCREEN (s);
+
+    gettimeofday (&tv, 0);
+
+    for (mc = ms->clients; mc; mc = next)
+    {
+	next = mc->next;
+
+	if (changed)
+	    mc->pending = TRUE;
+
+	if (!mc->pending)
+	    continue;
+
+	interval = getClientInterval (s->display, mc);
+	elapsed  = getTimeDiff (&tv, &mc->lastUpdate);
+
+	/* the poll timer itself may fire up to half an interval early */
+	if (elapsed + ms->interval / 2 >= interval)
+	{
+	    mc->pending    = FALSE;
+	    mc->lastUpdate = tv;
+
+	    if (mc->update)
+		(*mc->update) (s, ms->posX, ms->posY);
+	}
+	else if (wait < 0 || interval - elapsed < wait)
+	{
+	    wait = interval - elapsed;
+	}
+    }
+
+    return wait;
+}
+
 static Bool
 updatePosition (void *c)
 {
-    CompScreen      *s = (CompScreen *)c;
-    MousepollClient *mc;
+    CompScreen        *s = (CompScreen *)c;
+    CompTimeoutHandle handle;
+    Bool              changed;
+    int               wait, interval;
 
     MOUSEPOLL_SCREEN (s);
 
     if (!ms->clients)
+    {
+	ms->updateHandle = 0;
+	return FALSE;
+    }
+
+    handle  = ms->updateHandle;
+    changed = getMousePosition (s);
+
+    /* clients may stop polling or change the interval from their update
+       callback, the running timeout must not be removed meanwhile */
+    ms->inUpdate = TRUE;
+    wait = notifyClients (s, changed);
+    ms->inUpdate = FALSE;
+
+    /* polling was stopped, or stopped and started again */
+    if (ms->updateHandle != handle)
 	return FALSE;
 
-    if (getMousePosition (s))
+    if (changed || wait >= 0)
+	interval = ms->interval;
+    else
+	interval = MIN (ms->pollInterval * 2,
+			ms->interval * MOUSEPOLL_MAX_BACKOFF);
+
+    if (interval != ms->pollInterval)
     {
-	MousepollClient *next;
-	for (mc = ms->clients; mc; mc = next)
+	ms->pollInterval = interval;
+	ms->updateHandle = compAddTimeout (interval / 2, interval,
+					   updatePosition, s);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+#ifdef HAVE_XI2
+static Bool
+mousepollSelectXIEvents (CompScreen *s,
+			 Bool       enable)
+{
+    Display       *dpy = s->display->display;
+    XIEventMask   mask, *selected;
+    unsigned char bits[XIMaskLen (XI_LASTEVENT)] = { 0 };
+    int           i, nSelected;
+
+    /* the selection is per connection, so keep the events other plugins
+       selected on the root window */
+    selected = XIGetSelectedEvents (dpy, s->root, &nSelected);
+    if (selected)
+    {
+	for (i = 0; i < nSelected; i++)
 	{
-	    next = mc->next;
-	    if (mc->update)
-		(*mc->update) (s, ms->posX, ms->posY);
+	    if (selected[i].deviceid == XIAllMasterDevices)
+		memcpy (bits, selected[i].mask,
+			MIN (selected[i].mask_len, (int) sizeof (bits)));
 	}
+	XFree (selected);
+    }
+
+    if (enable)
+    {
+	XISetMask (bits, XI_RawMotion);
+	XISetMask (bits, XI_RawButtonPress);
+	XISetMask (bits, XI_RawButtonRelease);
+    }
+    else
+    {
+	XIClearMask (bits, XI_RawMotion);
+	XIClearMask (bits, XI_RawButtonPress);
+	XIClearMask (bits, XI_RawButtonRelease);
+    }
+
+    mask.deviceid = XIAllMasterDevices;
+    mask.mask_len = sizeof (bits);
+    mask.mask     = bits;
+
+    return XISelectEvents (dpy, s->root, &mask, 1) == Success;
+}
+
+static Bool
+eventUpdatePosition (void *c)
+{
+    CompScreen *s = (CompScreen *)c;
+    int        wait;
+
+    MOUSEPOLL_SCREEN (s);
+
+    ms->eventHandle = 0;
+
+    if (!ms->clients)
+	return FALSE;
+
+    gettimeofday (&ms->lastQuery, 0);
+
+    /* come back for clients that are not due for an update yet */
+    wait = notifyClients (s, getMousePosition (s));
+    if (wait >= 0)
+	ms->eventHandle = compAddTimeout (wait, wait, eventUpdatePosition, s);
+
+    return FALSE;
+}
+
+/* Raw events carry device deltas only, so the position itself is still
+   queried from the server. That happens once the pointer moved, but at
+   most once per interval of the fastest client, so fast mice don't cause
+   more round trips than polling did. */
+static void
+scheduleEventUpdate (CompDisplay *d)
+{
+    CompScreen      *s;
+    MousepollScreen *ms;
+    struct timeval  now;
+    int             wait;
+
+    MOUSEPOLL_DISPLAY (d);
+
+    for (s = d->screens; s; s = s->next)
+    {
+	ms = GET_MOUSEPOLL_SCREEN (s, md);
+	if (!ms->xiSelected || ms->eventHandle)
+	    continue;
+
+	gettimeofday (&now, 0);
+	wait = MAX (0, ms->interval - getTimeDiff (&now, &ms->lastQuery));
+
+	ms->eventHandle = compAddTimeout (wait, wait, eventUpdatePosition, s);
     }
+}
+
+static void
+mousepollHandleEvent (CompDisplay *d,
+		      XEvent      *event)
+{
+    MOUSEPOLL_DISPLAY (d);
+
+    switch (event->type) {
+    case GenericEvent:
+	if (md->xi2 && event->xcookie.extension == md->xiOpcode)
+	{
+	    switch (event->xcookie.evtype) {
+	    case XI_RawMotion:
+	    case XI_RawButtonPress:
+	    case XI_RawButtonRelease:
+		scheduleEventUpdate (d);
+		break;
+	    }
+	}
+	break;
+    case MotionNotify:
+    case EnterNotify:
+    case LeaveNotify:
+	/* pointer warps do not generate raw events */
+	scheduleEventUpdate (d);
+	break;
+    }
+
+    UNWRAP (md, d, handleEvent);
+    (*d->handleEvent) (d, event);
+    WRAP (md, d, handleEvent, mousepollHandleEvent);
+}
+
+static Bool
+mousepollInitXI2 (CompDisplay *d,
+		  int         *opcode)
+{
+    int event, error;
+    int major = 2, minor = 2;
+
+    if (!XQueryExtension (d->display, "XInputExtension",
+			  opcode, &event, &error))
+	return FALSE;
+
+    if (XIQueryVersion (d->display, &major, &minor) != Success)
+	return FALSE;
+
+    /* raw events are only delivered to root windows without a grab
+       since XI 2.1 */
+    if (major < 2 || (major == 2 && minor < 1))
+	return FALSE;
 
     return TRUE;
 }
+#endif
 
-static PositionPollingHandle
-mousepollAddPositionPolling (CompScreen         *s,
-			     PositionUpdateProc update)
+static void
+mousepollUpdateInterval (CompScreen *s)
+{
+    MousepollClient *mc;
+    int             interval = 0;
+
+    MOUSEPOLL_SCREEN (s);
+
+    for (mc = ms->clients; mc; mc = mc->next)
+    {
+	int clientInterval = getClientInterval (s->display, mc);
+
+	if (!interval || clientInterval < interval)
+	    interval = clientInterval;
+    }
+
+    if (!interval || interval == ms->interval)
+	return;
+
+    ms->interval = interval;
+
+    /* updatePosition reschedules itself once the clients are notified */
+    if (ms->updateHandle && !ms->inUpdate)
+    {
+	compRemoveTimeout (ms->updateHandle);
+	ms->pollInterval = interval;
+	ms->updateHandle = compAddTimeout (interval / 2, interval,
+					   updatePosition, s);
+    }
+}
+
+static void
+mousepollStartPolling (CompScreen *s)
 {
-    MOUSEPOLL_SCREEN  (s);
+    MOUSEPOLL_SCREEN (s);
+#ifdef HAVE_XI2
     MOUSEPOLL_DISPLAY (s->display);
+#endif
+
+    getMousePosition (s);
+
+#ifdef HAVE_XI2
+    if (md->xi2 && mousepollSelectXIEvents (s, TRUE))
+    {
+	ms->xiSelected = TRUE;
+	return;
+    }
+#endif
+
+    ms->pollInterval = ms->interval;
+    ms->updateHandle = compAddTimeout (ms->interval / 2, ms->interval,
+				       updatePosition, s);
+}
+
+static void
+mousepollStopPolling (CompScreen *s)
+{
+    MOUSEPOLL_SCREEN (s);
+
+#ifdef HAVE_XI2
+    if (ms->xiSelected)
+    {
+	mousepollSelectXIEvents (s, FALSE);
+	ms->xiSelected = FALSE;
+    }
+
+    if (ms->eventHandle)
+    {
+	compRemoveTimeout (ms->eventHandle);
+	ms->eventHandle = 0;
+    }
+#endif
+
+    if (ms->updateHandle)
+    {
+	/* the running timeout is dropped by updatePosition returning FALSE */
+	if (!ms->inUpdate)
+	    compRemoveTimeout (ms->updateHandle);
+	ms->updateHandle = 0;
+    }
+}
+
+static PositionPollingHandle
+mousepollAddPositionPollingWithRate (CompScreen         *s,
+				     PositionUpdateProc update,
+				     int                interval)
+{
+    MOUSEPOLL_SCREEN (s);
 
     Bool start = FALSE;
 
@@ -166,10 +571,14 @@ mousepollAddPositionPolling (CompScreen         *s,
     if (!ms->clients)
 	start = TRUE;
 
-    mc->update = update;
-    mc->id     = ms->freeId;
+    mc->update   = update;
+    mc->interval = MAX (0, interval);
+    mc->pending  = FALSE;
+    mc->id       = ms->freeId;
     ms->freeId++;
 
+    gettimeofday (&mc->lastUpdate, 0);
+
     mc->prev = NULL;
     mc->next = ms->clients;
 
@@ -178,36 +587,28 @@ mousepollAddPositionPolling (CompScreen         *s,
 
     ms->clients = mc;
 
+    mousepollUpdateInterval (s);
+
     if (start)
-    {
-	getMousePosition (s);
-	ms->updateHandle =
-	    compAddTimeout (
-		md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i / 2,
-		md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i,
-		updatePosition, s);
-    }
+	mousepollStartPolling (s);
 
     return mc->id;
 }
 
+static PositionPollingHandle
+mousepollAddPositionPolling (CompScreen         *s,
+			     PositionUpdateProc update)
+{
+    return mousepollAddPositionPollingWithRate (s, update, 0);
+}
+
 static void
 mousepollRemovePositionPolling (CompScreen            *s,
 				PositionPollingHandle id)
 {
     MOUSEPOLL_SCREEN (s);
 
-    MousepollClient *mc = ms->clients;
-
-    if (ms->clients && ms->clients->id == id)
-    {
-	ms->clients = ms->clients->next;
-	if (ms->clients)
-	    ms->clients->prev = NULL;
-
-	free (mc);
-	return;
-    }
+    MousepollClient *mc;
 
     for (mc = ms->clients; mc; mc = mc->next)
 	if (mc->id == id)
@@ -216,15 +617,16 @@ mousepollRemovePositionPolling (CompScreen            *s,
 		mc->next->prev = mc->prev;
 	    if (mc->prev)
 		mc->prev->next = mc->next;
+	    else
+		ms->clients = mc->next;
 	    free (mc);
-	    return;
+	    break;
 	}
 
-    if (!ms->clients && ms->updateHandle)
-    {
-	compRemoveTimeout (ms->updateHandle);
-	ms->updateHandle = 0;
-    }
+    if (!ms->clients)
+	mousepollStopPolling (s);
+    else
+	mousepollUpdateInterval (s);
 }
 
 static void
@@ -243,6 +645,73 @@ mousepollGetCurrentPosition (CompScreen *s,
 	*y = ms->posY;
 }
 
+/* Extrapolates the newest position in the history to delay ms from now,
+   using the average velocity over the last MOUSEPOLL_VELOCITY_WINDOW ms. */
+static Bool
+mousepollGetPredictedPosition (CompScreen *s,
+			       int        delay,
+			       int        *x,
+			       int        *y)
+{
+    MousepollSample *newest, *oldest = NULL;
+    struct timeval  tv;
+    double          age, dt, ahead;
+    int             i, px, py;
+
+    MOUSEPOLL_SCREEN (s);
+
+    mousepollGetCurrentPosition (s, x, y);
+
+    if (ms->historyCount < 2)
+	return FALSE;
+
+    gettimeofday (&tv, 0);
+
+    newest = &ms->history[ms->historyHead];
+    age    = getPreciseTimeDiff (&tv, &newest->time);
+
+    /* no new position for a while, the pointer has stopped */
+    if (age > 2 * ms->interval)
+	return FALSE;
+
+    for (i = 1; i < ms->historyCount; i++)
+    {
+	MousepollSample *sample;
+	int             index;
+
+	index  = (ms->historyHead - i + MOUSEPOLL_HISTORY_SIZE) %
+		 MOUSEPOLL_HISTORY_SIZE;
+	sample = &ms->history[index];
+	dt     = getPreciseTimeDiff (&newest->time, &sample->time);
+
+	/* always use the previous sample unless it is too old to belong
+	   to the current movement */
+	if (oldest && dt > MOUSEPOLL_VELOCITY_WINDOW)
+	    break;
+	if (!oldest && dt > 2 * ms->interval)
+	    return FALSE;
+
+	oldest = sample;
+    }
+
+    dt = getPreciseTimeDiff (&newest->time, &oldest->time);
+    if (dt <= 0)
+	return FALSE;
+
+    ahead = MIN (age + MAX (delay, 0), MOUSEPOLL_MAX_PREDICTION);
+
+    /* round to nearest, a plain conversion would truncate towards zero */
+    px = floor (newest->x + (newest->x - oldest->x) * ahead / dt + 0.5);
+    py = floor (newest->y + (newest->y - oldest->y) * ahead / dt + 0.5);
+
+    if (x)
+	*x = MAX (0, MIN (px, s->width - 1));
+    if (y)
+	*y = MAX (0, MIN (py, s->height - 1));
+
+    return TRUE;
+}
+
 static const CompMetadataOptionInfo mousepollDisplayOptionInfo[] = {
     { "abi", "int", 0, 0, 0 },
     { "index", "int", 0, 0, 0 },
@@ -284,16 +753,8 @@ mousepollSetDisplayOption (CompPlugin      *plugin,
 	for (s = display->screens; s; s = s->next)
 	{
 	    ms = GET_MOUSEPOLL_SCREEN (s, md);
-	    if (ms->updateHandle)
-	    {
-		compRemoveTimeout (ms->updateHandle);
-		ms->updateHandle =
-		    compAddTimeout (
-			md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i
-			/ 2,
-			md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i,
-   			updatePosition, s);
-	    }
+	    if (ms->clients)
+		mousepollUpdateInterval (s);
 	}
 	return status;
 	break;
@@ -306,9 +767,11 @@ mousepollSetDisplayOption (CompPlugin      *plugin,
 
 static MousePollFunc mousepollFunctions =
 {
-    .addPositionPolling    = mousepollAddPositionPolling,
-    .removePositionPolling = mousepollRemovePositionPolling,
-    .getCurrentPosition    = mousepollGetCurrentPosition,
+    .addPositionPolling         = mousepollAddPositionPolling,
+    .removePositionPolling      = mousepollRemovePositionPolling,
+    .getCurrentPosition         = mousepollGetCurrentPosition,
+    .addPositionPollingWithRate = mousepollAddPositionPollingWithRate,
+    .getPredictedPosition       = mousepollGetPredictedPosition,
 };
 
 static Bool
@@ -344,6 +807,12 @@ mousepollInitDisplay (CompPlugin  *p,
     md->opt[MP_DISPLAY_OPTION_ABI].value.i   = MOUSEPOLL_ABIVERSION;
     md->opt[MP_DISPLAY_OPTION_INDEX].value.i = functionsPrivateIndex;
 
+#ifdef HAVE_XI2
+    md->xi2 = mousepollInitXI2 (d, &md->xiOpcode);
+
+    WRAP (md, d, handleEvent, mousepollHandleEvent);
+#endif
+
     d->base.privates[displayPrivateIndex].ptr   = md;
     d->base.privates[functionsPrivateIndex].ptr = &mousepollFunctions;
     return TRUE;
@@ -355,6 +824,10 @@ mousepollFiniDisplay (CompPlugin  *p,
 {
     MOUSEPOLL_DISPLAY (d);
 
+#ifdef HAVE_XI2
+    UNWRAP (md, d, handleEvent);
+#endif
+
     compFiniDisplayOptions (d, md->opt, MP_DISPLAY_OPTION_NUM);
     free (md);
 }
@@ -376,10 +849,23 @@ mousepollInitScreen (CompPlugin *p,
 
     ms->buttons = 0;
 
+    ms->historyHead  = 0;
+    ms->historyCount = 0;
+
     ms->clients = NULL;
     ms->freeId  = 1;
     
     ms->updateHandle = 0;
+    ms->inUpdate     = FALSE;
+    ms->interval     = md->opt[MP_DISPLAY_OPTION_MOUSE_POLL_INTERVAL].value.i;
+    ms->pollInterval = ms->interval;
+
+#ifdef HAVE_XI2
+    ms->xiSelected   = FALSE;
+    ms->eventHandle  = 0;
+    ms->lastQuery.tv_sec  = 0;
+    ms->lastQuery.tv_usec = 0;
+#endif
 
     s->base.privates[md->screenPrivateIndex].ptr = ms;
     return TRUE;
@@ -391,8 +877,7 @@ mousepollFiniScreen (CompPlugin *p,
 {
     MOUSEPOLL_SCREEN (s);
 
-    if (ms->updateHandle)
-	compRemoveTimeout (ms->updateHandle);
+    mousepollStopPolling (s);
 
     free (ms);
 }
@@ -27,6 +27,9 @@
 #include <compiz-core.h>
 #include "neg_options.h"
 
+/* Number of windows updated at once after a match setting change */
+#define MATCH_UPDATE_BATCH_SIZE 32
+
 static int displayPrivateIndex;
 static int corePrivateIndex;
 
@@ -37,6 +40,9 @@ typedef struct _NEGCore {
 typedef struct _NEGDisplay
 {
     int screenPrivateIndex;
+
+    MatchPropertyChangedProc   matchPropertyChanged;
+    MatchExpHandlerChangedProc matchExpHandlerChanged;
 } NEGDisplay;
 
 
@@ -55,8 +61,11 @@ typedef struct _NEGScreen
     Bool keyMatchToggled; /* match group is toggled using the "Toggle Matched
                              Windows Negative" keybinding */
 
-    int negFunction;
-    int negAlphaFunction;
+    /* negative fragment functions, indexed by fetch target and alpha
+       handling (the alpha one is also used for decorations) */
+    int negFunctions[COMP_FETCH_TARGET_NUM][2];
+
+    CompTimeoutHandle matchUpdateHandle;
 } NEGScreen;
 
 typedef struct _NEGWindow
@@ -70,6 +79,11 @@ typedef struct _NEGWindow
                              "Toggle Window Negative" keybinding. This preserves
                              the window state between screen toggles for Preserve
                              Toggled Windows. */
+
+    Bool matchesValid; /* negMatched and excludeMatched are up to date, unset
+                          when the window properties or the matches change */
+    Bool negMatched;
+    Bool excludeMatched;
 } NEGWindow;
 
 #define GET_NEG_CORE(c) \
@@ -92,6 +106,41 @@ typedef struct _NEGWindow
 		    GET_NEG_DISPLAY (w->screen->display)))
 
 
+/* NEGUpdateMatches: evaluate the matches for a window if its cached results
+   are out of date. */
+static void
+NEGUpdateMatches (CompWindow *w)
+{
+    NEG_WINDOW (w);
+
+    if (nw->matchesValid)
+	return;
+
+    nw->negMatched     = matchEval (negGetNegMatch (w->screen), w);
+    nw->excludeMatched = matchEval (negGetExcludeMatch (w->screen), w);
+    nw->matchesValid   = TRUE;
+}
+
+static Bool
+NEGWindowIsMatched (CompWindow *w)
+{
+    NEG_WINDOW (w);
+
+    NEGUpdateMatches (w);
+
+    return nw->negMatched;
+}
+
+static Bool
+NEGWindowIsExcluded (CompWindow *w)
+{
+    NEG_WINDOW (w);
+
+    NEGUpdateMatches (w);
+
+    return nw->excludeMatched;
+}
+
 static void
 NEGUpdateState (CompWindow *w)
 {
@@ -104,11 +153,11 @@ NEGUpdateState (CompWindow *w)
        the various parameters that can affect this, and set windowState thus */
 
     windowState =
-       ((ns->keyMatchToggled &&   matchEval (negGetNegMatch (w->screen), w)) ^
-	(ns->matchNeg        &&   matchEval (negGetNegMatch (w->screen), w)))
+       ((ns->keyMatchToggled &&   NEGWindowIsMatched (w)) ^
+	(ns->matchNeg        &&   NEGWindowIsMatched (w)))
 	||
-        ((ns->keyNegToggled  && ! matchEval (negGetExcludeMatch (w->screen), w)) ^
-	(ns->isNeg           && ! matchEval (negGetExcludeMatch (w->screen), w)));
+        ((ns->keyNegToggled  && ! NEGWindowIsExcluded (w)) ^
+	(ns->isNeg           && ! NEGWindowIsExcluded (w)));
 
     /* Individual window state */
     if (nw->keyNegToggled)
@@ -136,6 +185,56 @@ NEGUpdateScreen (CompScreen *s)
 	NEGUpdateState (w);
 }
 
+/* NEGMatchUpdateTimeout: update a batch of windows whose match results were
+   invalidated, then let events be processed before the next batch. */
+static Bool
+NEGMatchUpdateTimeout (void *closure)
+{
+    CompScreen *s = closure;
+    CompWindow *w;
+    int        count = 0;
+
+    NEG_SCREEN (s);
+
+    for (w = s->windows; w; w = w->next)
+    {
+	NEG_WINDOW (w);
+
+	if (nw->matchesValid)
+	    continue;
+
+	if (count++ == MATCH_UPDATE_BATCH_SIZE)
+	    return TRUE;
+
+	/* NEGUpdateState only evaluates the matches it needs */
+	NEGUpdateMatches (w);
+	NEGUpdateState (w);
+    }
+
+    ns->matchUpdateHandle = 0;
+
+    return FALSE;
+}
+
+/* NEGScheduleMatchUpdate: invalidate the match results of every window and
+   update them at idle time, so that editing a match does not block. */
+static void
+NEGScheduleMatchUpdate (CompScreen *s)
+{
+    CompWindow *w;
+
+    NEG_SCREEN (s);
+
+    for (w = s->windows; w; w = w->next)
+    {
+	NEG_WINDOW (w);
+	nw->matchesValid = FALSE;
+    }
+
+    if (!ns->matchUpdateHandle)
+	ns->matchUpdateHandle = compAddTimeout (0, 0, NEGMatchUpdateTimeout, s);
+}
+
 /* NEGWindowUpdateKeyToggle: This function updates the window-toggled state
    bools for a given window if needed for the Preserve Toggled Windows
    option. */
@@ -178,7 +277,7 @@ NEGScreenClearToggled (CompScreen *s)
 
     for (w = s->windows; w; w = w->next)
     {
-	if (! matchEval (negGetExcludeMatch (w->screen), w)) {
+	if (! NEGWindowIsExcluded (w)) {
 	    NEG_WINDOW (w);
 	    nw->keyNegToggled = FALSE;
 	    nw->keyNegPreserved = FALSE;
@@ -194,7 +293,7 @@ NEGToggleScreen (CompScreen *s)
 
     /* update toggle state for relevant windows */
     for (w = s->windows; w; w = w->next)
-	if (negGetPreserveToggled (s) && ! matchEval (negGetExcludeMatch (s), w))
+	if (negGetPreserveToggled (s) && ! NEGWindowIsExcluded (w))
 	    NEGWindowUpdateKeyToggle (w);
 
     /* Clear toggled window state if the Auto-Clear config option is set */
@@ -216,7 +315,7 @@ NEGMatchClearToggled (CompScreen *s)
 
     for (w = s->windows; w; w = w->next)
     {
-	if (matchEval (negGetNegMatch (w->screen), w)) {
+	if (NEGWindowIsMatched (w)) {
 	    NEG_WINDOW (w);
 	    nw->keyNegToggled = FALSE;
 	    nw->keyNegPreserved = FALSE;
@@ -232,7 +331,7 @@ NEGToggleMatches (CompScreen *s)
 
     /* update toggle state for relevant windows */
     for (w = s->windows; w; w = w->next)
-	if (negGetPreserveToggled (s) && matchEval (negGetNegMatch (s), w))
+	if (negGetPreserveToggled (s) && NEGWindowIsMatched (w))
 	    NEGWindowUpdateKeyToggle (w);
 
     /* Clear toggled window state if the Auto-Clear config option is set */
@@ -302,30 +401,11 @@ negToggleMatched (CompDisplay     *d,
 }
 
 static int
-getNegFragmentFunction (CompScreen  *s,
-			CompTexture *texture,
-			Bool        alpha)
+buildNegFragmentFunction (CompScreen *s,
+			  int        target,
+			  Bool       alpha)
 {
     CompFunctionData *data;
-    int              target;
-
-    NEG_SCREEN (s);
-
-    if (texture->target == GL_TEXTURE_2D)
-	target = COMP_FETCH_TARGET_2D;
-    else
-	target = COMP_FETCH_TARGET_RECT;
-
-    if (alpha)
-    {
-	if (ns->negAlphaFunction)
-	    return ns->negAlphaFunction;
-    }
-    else
-    {
-	if (ns->negFunction)
-	    return ns->negFunction;
-    }
 
     data = createFunctionData ();
     if (data)
@@ -360,11 +440,6 @@ getNegFragmentFunction (CompScreen  *s,
 
 	handle = createFragmentFunction (s, "neg", data);
 
-	if (alpha)
-	    ns->negAlphaFunction = handle;
-	else
-	    ns->negFunction = handle;
-
 	destroyFunctionData (data);
 
 	return handle;
@@ -380,7 +455,8 @@ NEGDrawWindowTexture (CompWindow           *w,
 		      unsigned int         mask)
 {
 	FragmentAttrib fa = *attrib;
-	int            function;
+	int            function, target;
+	Bool           alpha;
 
 	NEG_SCREEN (w->screen);
 	NEG_WINDOW (w);
@@ -399,7 +475,14 @@ NEGDrawWindowTexture (CompWindow           *w,
 		return;
 	}
 
-	function = getNegFragmentFunction (w->screen, texture, negGetNegDecorations (w->screen) ? TRUE : w->alpha);
+	if (texture->target == GL_TEXTURE_2D)
+		target = COMP_FETCH_TARGET_2D;
+	else
+		target = COMP_FETCH_TARGET_RECT;
+
+	alpha = negGetNegDecorations (w->screen) ? TRUE : w->alpha;
+
+	function = ns->negFunctions[target][alpha ? 1 : 0];
 	if (function)
 		addFragmentFunction (&fa, function);
 
@@ -441,7 +524,7 @@ NEGScreenOptionChanged (CompScreen       *s,
 	break;
     case NegScreenOptionNegMatch:
 	{
-	    NEGUpdateScreen (s);
+	    NEGScheduleMatchUpdate (s);
 	}
 	break;
     case NegScreenOptionToggleScreenByDefault:
@@ -462,7 +545,7 @@ NEGScreenOptionChanged (CompScreen       *s,
 	break;
     case NegScreenOptionExcludeMatch:
 	{
-	    NEGUpdateScreen (s);
+	    NEGScheduleMatchUpdate (s);
 	}
 	break;
     case NegScreenOptionPreserveToggled:
@@ -480,6 +563,37 @@ NEGScreenOptionChanged (CompScreen       *s,
     }
 }
 
+static void
+NEGMatchPropertyChanged (CompDisplay *d,
+			 CompWindow  *w)
+{
+    NEG_DISPLAY (d);
+    NEG_WINDOW (w);
+
+    /* Only this window needs its matches evaluated again */
+    nw->matchesValid = FALSE;
+    NEGUpdateState (w);
+
+    UNWRAP (nd, d, matchPropertyChanged);
+    (*d->matchPropertyChanged) (d, w);
+    WRAP (nd, d, matchPropertyChanged, NEGMatchPropertyChanged);
+}
+
+static void
+NEGMatchExpHandlerChanged (CompDisplay *d)
+{
+    CompScreen *s;
+
+    NEG_DISPLAY (d);
+
+    UNWRAP (nd, d, matchExpHandlerChanged);
+    (*d->matchExpHandlerChanged) (d);
+    WRAP (nd, d, matchExpHandlerChanged, NEGMatchExpHandlerChanged);
+
+    for (s = d->screens; s; s = s->next)
+	NEGScheduleMatchUpdate (s);
+}
+
 static void
 NEGObjectAdd (CompObject *parent,
 	      CompObject *object)
@@ -558,6 +672,9 @@ NEGInitDisplay (CompPlugin  *p,
 	return FALSE;
     }
 
+    WRAP (nd, d, matchPropertyChanged, NEGMatchPropertyChanged);
+    WRAP (nd, d, matchExpHandlerChanged, NEGMatchExpHandlerChanged);
+
     negSetWindowToggleKeyInitiate  (d, negToggle);
     negSetScreenToggleKeyInitiate  (d, negToggleAll);
     negSetMatchedToggleKeyInitiate (d, negToggleMatched);
@@ -582,6 +699,9 @@ NEGFiniDisplay (CompPlugin  *p,
 
     freeScreenPrivateIndex (d, nd->screenPrivateIndex);
 
+    UNWRAP (nd, d, matchPropertyChanged);
+    UNWRAP (nd, d, matchExpHandlerChanged);
+
     free (nd);
 }
 
@@ -590,6 +710,7 @@ NEGInitScreen (CompPlugin *p,
 	       CompScreen *s)
 {
     NEGScreen *ns;
+    int       target, alpha;
 
     NEG_DISPLAY (s->display);
 
@@ -612,8 +733,19 @@ NEGInitScreen (CompPlugin *p,
     ns->matchNeg        = negGetToggleByDefault (s);
     ns->keyMatchToggled = FALSE;
 
-    ns->negFunction      = 0;
-    ns->negAlphaFunction = 0;
+    /* build all the fragment functions now rather than on first paint */
+    for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
+    {
+	for (alpha = 0; alpha < 2; alpha++)
+	{
+	    ns->negFunctions[target][alpha] = 0;
+	    if (s->fragmentProgram)
+		ns->negFunctions[target][alpha] =
+		    buildNegFragmentFunction (s, target, alpha);
+	}
+    }
+
+    ns->matchUpdateHandle = 0;
 
     negSetToggleByDefaultNotify (s, NEGScreenOptionChanged);
     negSetNegMatchNotify (s, NEGScreenOptionChanged);
@@ -634,16 +766,21 @@ static void
 NEGFiniScreen (CompPlugin *p,
 	       CompScreen *s)
 {
+    int target, alpha;
+
     NEG_SCREEN (s);
 
     freeWindowPrivateIndex (s, ns->windowPrivateIndex);
 
     UNWRAP (ns, s, drawWindowTexture);
 
-    if (ns->negFunction)
-	destroyFragmentFunction (s, ns->negFunction);
-    if (ns->negAlphaFunction)
-	destroyFragmentFunction (s, ns->negAlphaFunction);
+    if (ns->matchUpdateHandle)
+	compRemoveTimeout (ns->matchUpdateHandle);
+
+    for (target = 0; target < COMP_FETCH_TARGET_NUM; target++)
+	for (alpha = 0; alpha < 2; alpha++)
+	    if (ns->negFunctions[target][alpha])
+		destroyFragmentFunction (s, ns->negFunctions[target][alpha]);
 
     free (ns);
 }
@@ -664,6 +801,10 @@ NEGInitWindow (CompPlugin *p,
     nw->keyNegToggled   = FALSE;
     nw->keyNegPreserved = FALSE;
 
+    nw->matchesValid   = FALSE;
+    nw->negMatched     = FALSE;
+    nw->excludeMatched = FALSE;
+
     w->base.privates[ns->windowPrivateIndex].ptr = nw;
 
     return TRUE;
@@ -33,14 +33,9 @@
 
 #include <X11/Xatom.h>
 
-#include <cairo-xlib-xrender.h>
-#include <pango/pango.h>
-#include <pango/pangocairo.h>
-
 #include <compiz-core.h>
 #include "compiz-text.h"
-
-#define PI 3.14159265359f
+#include "textrender.h"
 
 static CompMetadata textMetadata;
 
@@ -52,8 +47,14 @@ static int functionsPrivateIndex;
 #define TEXT_DISPLAY_OPTION_NUM    2
 
 typedef struct _TextDisplay {
+    int screenPrivateIndex;
+
+    HandleEventProc handleEvent;
+
     Atom visibleNameAtom;
 
+    TextMeasureLayout measure;
+
     CompOption opt[TEXT_DISPLAY_OPTION_NUM];
 } TextDisplay;
 
@@ -63,20 +64,31 @@ typedef struct _TextDisplay {
 #define TEXT_DISPLAY(d)			 \
     TextDisplay *td = GET_TEXT_DISPLAY (d)
 
-#define NUM_OPTIONS(d) (sizeof ((d)->opt) / sizeof (CompOption))
+typedef struct _TextScreen {
+    int windowPrivateIndex;
+} TextScreen;
 
-typedef struct _TextSurfaceData {
-    int                  width;
-    int                  height;
+#define GET_TEXT_SCREEN(s, td)				       \
+    ((TextScreen *) (s)->base.privates[(td)->screenPrivateIndex].ptr)
 
-    cairo_t              *cr;
-    cairo_surface_t      *surface;
-    PangoLayout          *layout;
-    Pixmap               pixmap;
-    XRenderPictFormat    *format;
-    PangoFontDescription *font;
-    Screen               *screen;
-} TextSurfaceData;
+#define TEXT_SCREEN(s)							  \
+    TextScreen *ts = GET_TEXT_SCREEN (s, GET_TEXT_DISPLAY (s->display))
+
+/* window title, fetched on first use and dropped when it changes */
+typedef struct _TextWindow {
+    char *title;
+    Bool titleValid;
+} TextWindow;
+
+#define GET_TEXT_WINDOW(w, ts)				       \
+    ((TextWindow *) (w)->base.privates[(ts)->windowPrivateIndex].ptr)
+
+#define TEXT_WINDOW(w)					   \
+    TextWindow *tw = GET_TEXT_WINDOW  (w,		   \
+		     GET_TEXT_SCREEN  (w->screen,	   \
+		     GET_TEXT_DISPLAY (w->screen->display)))
+
+#define NUM_OPTIONS(d) (sizeof ((d)->opt) / sizeof (CompOption))
 
 static char *
 textGetUtf8Property (CompDisplay *d,
@@ -157,236 +169,30 @@ textGetWindowName (CompDisplay *d,
     return name;
 }
 
-/*
- * Draw a rounded rectangle path
- */
-static void
-textDrawTextBackground (cairo_t *cr,
-			int     x,
-			int     y,
-			int     width,
-			int     height,
-			int     radius)
-{
-    int x0, y0, x1, y1;
-
-    x0 = x;
-    y0 = y;
-    x1 = x + width;
-    y1 = y + height;
-
-    cairo_new_path (cr);
-    cairo_arc (cr, x0 + radius, y1 - radius, radius, PI / 2, PI);
-    cairo_line_to (cr, x0, y0 + radius);
-    cairo_arc (cr, x0 + radius, y0 + radius, radius, PI, 3 * PI / 2);
-    cairo_line_to (cr, x1 - radius, y0);
-    cairo_arc (cr, x1 - radius, y0 + radius, radius, 3 * PI / 2, 2 * PI);
-    cairo_line_to (cr, x1, y1 - radius);
-    cairo_arc (cr, x1 - radius, y1 - radius, radius, 0, PI / 2);
-    cairo_close_path (cr);
-}
-
-static Bool
-textInitCairo (CompScreen      *s,
-	       TextSurfaceData *data,
-	       int             width,
-	       int             height)
+static const char *
+textGetCachedWindowName (CompWindow *w)
 {
-    Display *dpy = s->display->display;
-
-    data->pixmap = None;
-    if (width > 0 && height > 0)
-	data->pixmap = XCreatePixmap (dpy, s->root, width, height, 32);
-
-    data->width  = width;
-    data->height = height;
-
-    if (!data->pixmap)
-    {
-	compLogMessage ("text", CompLogLevelError,
-			"Couldn't create %d x %d pixmap.", width, height);
-	return FALSE;
-    }
-
-    data->surface = cairo_xlib_surface_create_with_xrender_format (dpy,
-								   data->pixmap,
-								   data->screen,
-								   data->format,
-								   width,
-								   height);
-    if (cairo_surface_status (data->surface) != CAIRO_STATUS_SUCCESS)
-    {
-	compLogMessage ("text", CompLogLevelError, "Couldn't create surface.");
-	return FALSE;
-    }
+    TEXT_WINDOW (w);
 
-    data->cr = cairo_create (data->surface);
-    if (cairo_status (data->cr) != CAIRO_STATUS_SUCCESS)
+    if (!tw->titleValid)
     {
-	compLogMessage ("text", CompLogLevelError,
-			"Couldn't create cairo context.");
-	return FALSE;
+	tw->title      = textGetWindowName (w->screen->display, w->id);
+	tw->titleValid = TRUE;
     }
 
-    return TRUE;
+    return tw->title;
 }
 
-static Bool
-textInitSurface (CompScreen      *s,
-		 TextSurfaceData *data)
-{
-    Display *dpy = s->display->display;
-
-    data->screen = ScreenOfDisplay (dpy, s->screenNum);
-    if (!data->screen)
-    {
-	compLogMessage ("text", CompLogLevelError,
-			"Couldn't get screen for %d.", s->screenNum);
-	return FALSE;
-    }
-
-    data->format = XRenderFindStandardFormat (dpy, PictStandardARGB32);
-    if (!data->format)
-    {
-	compLogMessage ("text", CompLogLevelError, "Couldn't get format.");
-	return FALSE;
-    }
-
-    if (!textInitCairo (s, data, 1, 1))
-	return FALSE;
-
-    /* init pango */
-    data->layout = pango_cairo_create_layout (data->cr);
-    if (!data->layout)
-    {
-	compLogMessage ("text", CompLogLevelError,
-			"Couldn't create pango layout.");
-	return FALSE;
-    }
-
-    data->font = pango_font_description_new ();
-    if (!data->font)
-    {
-	compLogMessage ("text", CompLogLevelError,
-			"Couldn't create font description.");
-	return FALSE;
-    }
-
-    return TRUE;
-}
-
-static Bool
-textUpdateSurface (CompScreen      *s,
-		   TextSurfaceData *data,
-		   int             width,
-		   int             height)
-{
-    Display *dpy = s->display->display;
-
-    cairo_surface_destroy (data->surface);
-    data->surface = NULL;
-
-    cairo_destroy (data->cr);
-    data->cr = NULL;
-
-    XFreePixmap (dpy, data->pixmap);
-    data->pixmap = None;
-
-    return textInitCairo (s, data, width, height);
-}
-
-static Bool
-textRenderTextToSurface (CompScreen           *s,
-			 const char           *text,
-			 TextSurfaceData      *data,
-			 const CompTextAttrib *attrib)
+static void
+textInvalidateWindowName (CompWindow *w)
 {
-    int width, height, layoutWidth;
-
-    pango_font_description_set_family (data->font, attrib->family);
-    pango_font_description_set_absolute_size (data->font,
-					      attrib->size * PANGO_SCALE);
-    pango_font_description_set_style (data->font, PANGO_STYLE_NORMAL);
-
-    if (attrib->flags & CompTextFlagStyleBold)
-	pango_font_description_set_weight (data->font, PANGO_WEIGHT_BOLD);
-
-    if (attrib->flags & CompTextFlagStyleItalic)
-	pango_font_description_set_style (data->font, PANGO_STYLE_ITALIC);
-
-    pango_layout_set_font_description (data->layout, data->font);
-
-    if (attrib->flags & CompTextFlagEllipsized)
-	pango_layout_set_ellipsize (data->layout, PANGO_ELLIPSIZE_END);
+    TEXT_WINDOW (w);
 
-    pango_layout_set_auto_dir (data->layout, FALSE);
-    pango_layout_set_text (data->layout, text, -1);
+    if (tw->title)
+	free (tw->title);
 
-    pango_layout_get_pixel_size (data->layout, &width, &height);
-
-    if (attrib->flags & CompTextFlagWithBackground)
-    {
-	width  += 2 * attrib->bgHMargin;
-	height += 2 * attrib->bgVMargin;
-    }
-
-    width  = MIN (attrib->maxWidth, width);
-    height = MIN (attrib->maxHeight, height);
-
-    /* update the size of the pango layout */
-    layoutWidth = attrib->maxWidth;
-    if (attrib->flags & CompTextFlagWithBackground)
-	layoutWidth -= 2 * attrib->bgHMargin;
-
-    pango_layout_set_width (data->layout, layoutWidth * PANGO_SCALE);
-
-    if (!textUpdateSurface (s, data, width, height))
-	return FALSE;
-
-    pango_cairo_update_layout (data->cr, data->layout);
-
-    cairo_save (data->cr);
-    cairo_set_operator (data->cr, CAIRO_OPERATOR_CLEAR);
-    cairo_paint (data->cr);
-    cairo_restore (data->cr);
-
-    cairo_set_operator (data->cr, CAIRO_OPERATOR_OVER);
-
-    if (attrib->flags & CompTextFlagWithBackground)
-    {
-	textDrawTextBackground (data->cr, 0, 0, width, height,
-				MIN (attrib->bgHMargin, attrib->bgVMargin));
-	cairo_set_source_rgba (data->cr,
-			       attrib->bgColor[0] / 65535.0,
-			       attrib->bgColor[1] / 65535.0,
-			       attrib->bgColor[2] / 65535.0,
-			       attrib->bgColor[3] / 65535.0);
-	cairo_fill (data->cr);
-	cairo_move_to (data->cr, attrib->bgHMargin, attrib->bgVMargin);
-    }
-
-    cairo_set_source_rgba (data->cr,
-			   attrib->color[0] / 65535.0,
-			   attrib->color[1] / 65535.0,
-			   attrib->color[2] / 65535.0,
-			   attrib->color[3] / 65535.0);
-
-    pango_cairo_show_layout (data->cr, data->layout);
-
-    return TRUE;
-}
-
-static void
-textCleanupSurface (TextSurfaceData *data)
-{
-    if (data->layout)
-	g_object_unref (data->layout);
-    if (data->surface)
-	cairo_surface_destroy (data->surface);
-    if (data->cr)
-	cairo_destroy (data->cr);
-    if (data->font)
-	pango_font_description_free (data->font);
+    tw->title      = NULL;
+    tw->titleValid = FALSE;
 }
 
 static CompTextData *
@@ -394,16 +200,15 @@ textRenderText (CompScreen           *s,
 		const char           *text,
 		const CompTextAttrib *attrib)
 {
-    TextSurfaceData surface;
-    CompTextData    *retval = NULL;
+    CompTextData *retval = NULL;
+    Pixmap       pixmap;
+    int          width, height;
 
     if (!text || !strlen (text))
 	return NULL;
 
-    memset (&surface, 0, sizeof (TextSurfaceData));
-
-    if (textInitSurface (s, &surface) &&
-	textRenderTextToSurface (s, text, &surface, attrib))
+    if (textRenderTextToPixmap (s->display->display, s->screenNum,
+				text, attrib, &pixmap, &width, &height))
     {
 	retval = calloc (1, sizeof (CompTextData));
 	if (retval && !(attrib->flags & CompTextFlagNoAutoBinding))
@@ -418,9 +223,9 @@ textRenderText (CompScreen           *s,
 
 	if (retval)
 	{
-	    retval->pixmap = surface.pixmap;
-	    retval->width  = surface.width;
-	    retval->height = surface.height;
+	    retval->pixmap = pixmap;
+	    retval->width  = width;
+	    retval->height = height;
 
 	    if (retval->texture)
 	    {
@@ -436,14 +241,34 @@ textRenderText (CompScreen           *s,
 		}
 	    }
 	}
+
+	if (!retval)
+	    XFreePixmap (s->display->display, pixmap);
     }
 
-    if (!retval && surface.pixmap)
-	XFreePixmap (s->display->display, surface.pixmap);
+    return retval;
+}
+
+static Bool
+textMeasureText (CompScreen           *s,
+		 const char           *text,
+		 const CompTextAttrib *attrib,
+		 CompTextExtents      *extents)
+{
+    TEXT_DISPLAY (s->display);
+
+    if (!text || !strlen (text))
+	return FALSE;
 
-    textCleanupSurface (&surface);
+    /* the layout is kept around, so only the first call pays for it */
+    if (!td->measure.layout &&
+	!textInitMeasureLayout (s->display->display, s->screenNum,
+				&td->measure))
+	return FALSE;
 
-    return retval;
+    textMeasureLayoutText (&td->measure, text, attrib, extents);
+
+    return TRUE;
 }
 
 static CompTextData *
@@ -452,47 +277,33 @@ textRenderWindowTitle (CompScreen           *s,
 		       Bool                 withViewportNumber,
 		       const CompTextAttrib *attrib)
 {
-    char         *text = NULL;
+    CompWindow   *w;
+    const char   *name;
+    char         *title = NULL, *text = NULL;
     CompTextData *retval;
 
-    if (withViewportNumber)
-    {
-	char *title;
-	
-	title = textGetWindowName (s->display, window);
-	if (title)
-	{
-	    CompWindow *w;
-
-	    w = findWindowAtDisplay (s->display, window);
-	    if (w)
-	    {
-		int vx, vy, viewport;
-
-		defaultViewportForWindow (w, &vx, &vy);
-		viewport = vy * w->screen->hsize + vx + 1;
-		if (asprintf (&text, "%s -[%d]-", title, viewport) == -1)
-		{
-			free (title);
-			return textRenderText (s, "Error: textRenderWindowTitle", attrib);
-		}
-		free (title);
-	    }
-	    else
-	    {
-		text = title;
-	    }
-	}
-    }
+    w = findWindowAtDisplay (s->display, window);
+    if (w)
+	name = textGetCachedWindowName (w);
     else
+	name = title = textGetWindowName (s->display, window);
+
+    if (name && w && withViewportNumber)
     {
-	text = textGetWindowName (s->display, window);
+	int vx, vy, viewport;
+
+	defaultViewportForWindow (w, &vx, &vy);
+	viewport = vy * w->screen->hsize + vx + 1;
+	if (asprintf (&text, "%s -[%d]-", name, viewport) == -1)
+	    return textRenderText (s, "Error: textRenderWindowTitle", attrib);
     }
 
-    retval = textRenderText (s, text, attrib);
+    retval = textRenderText (s, text ? text : name, attrib);
 
     if (text)
 	free (text);
+    if (title)
+	free (title);
 
     return retval;
 }
@@ -571,8 +382,38 @@ static TextFunc textFunctions =
     .renderText        = textRenderText,
     .renderWindowTitle = textRenderWindowTitle,
     .drawText          = textDrawText,
-    .finiTextData      = textFiniTextData
+    .finiTextData      = textFiniTextData,
+    .measureText       = textMeasureText
 };
+
+static void
+textHandleEvent (CompDisplay *d,
+		 XEvent      *event)
+{
+    CompWindow *w;
+
+    TEXT_DISPLAY (d);
+
+    /* drop stale titles before anyone else gets to re-render them */
+    if (event->type == PropertyNotify)
+    {
+	Atom atom = event->xproperty.atom;
+
+	if (atom == td->visibleNameAtom ||
+	    atom == d->wmNameAtom       ||
+	    atom == XA_WM_NAME)
+	{
+	    w = findWindowAtDisplay (d, event->xproperty.window);
+	    if (w)
+		textInvalidateWindowName (w);
+	}
+    }
+
+    UNWRAP (td, d, handleEvent);
+    (*d->handleEvent) (d, event);
+    WRAP (td, d, handleEvent, textHandleEvent);
+}
+
 static const CompMetadataOptionInfo textDisplayOptionInfo[] = {
     { "abi", "int", 0, 0, 0 },
     { "index", "int", 0, 0, 0 }
@@ -612,12 +453,26 @@ textInitDisplay (CompPlugin  *p,
 	return FALSE;
     }
 
+    td->screenPrivateIndex = allocateScreenPrivateIndex (d);
+    if (td->screenPrivateIndex < 0)
+    {
+	compFiniDisplayOptions (d, td->opt, TEXT_DISPLAY_OPTION_NUM);
+	free (td);
+	return FALSE;
+    }
+
     td->visibleNameAtom = XInternAtom (d->display,
 				       "_NET_WM_VISIBLE_NAME", 0);
 
+    td->measure.context = NULL;
+    td->measure.layout  = NULL;
+    td->measure.font    = NULL;
+
     td->opt[TEXT_DISPLAY_OPTION_ABI].value.i   = TEXT_ABIVERSION;
     td->opt[TEXT_DISPLAY_OPTION_INDEX].value.i = functionsPrivateIndex;
 
+    WRAP (td, d, handleEvent, textHandleEvent);
+
     d->base.privates[displayPrivateIndex].ptr   = td;
     d->base.privates[functionsPrivateIndex].ptr = &textFunctions;
 
@@ -630,18 +485,93 @@ textFiniDisplay (CompPlugin  *p,
 {
     TEXT_DISPLAY (d);
 
+    UNWRAP (td, d, handleEvent);
+
+    freeScreenPrivateIndex (d, td->screenPrivateIndex);
+
+    textFiniMeasureLayout (&td->measure);
+
     compFiniDisplayOptions (d, td->opt, TEXT_DISPLAY_OPTION_NUM);
 
     free (td);
 }
 
+static Bool
+textInitScreen (CompPlugin *p,
+		CompScreen *s)
+{
+    TextScreen *ts;
+
+    TEXT_DISPLAY (s->display);
+
+    ts = malloc (sizeof (TextScreen));
+    if (!ts)
+	return FALSE;
+
+    ts->windowPrivateIndex = allocateWindowPrivateIndex (s);
+    if (ts->windowPrivateIndex < 0)
+    {
+	free (ts);
+	return FALSE;
+    }
+
+    s->base.privates[td->screenPrivateIndex].ptr = ts;
+
+    return TRUE;
+}
+
+static void
+textFiniScreen (CompPlugin *p,
+		CompScreen *s)
+{
+    TEXT_SCREEN (s);
+
+    freeWindowPrivateIndex (s, ts->windowPrivateIndex);
+
+    free (ts);
+}
+
+static Bool
+textInitWindow (CompPlugin *p,
+		CompWindow *w)
+{
+    TextWindow *tw;
+
+    TEXT_SCREEN (w->screen);
+
+    tw = malloc (sizeof (TextWindow));
+    if (!tw)
+	return FALSE;
+
+    tw->title      = NULL;
+    tw->titleValid = FALSE;
+
+    w->base.privates[ts->windowPrivateIndex].ptr = tw;
+
+    return TRUE;
+}
+
+static void
+textFiniWindow (CompPlugin *p,
+		CompWindow *w)
+{
+    TEXT_WINDOW (w);
+
+    if (tw->title)
+	free (tw->title);
+
+    free (tw);
+}
+
 static CompBool
 textInitObject (CompPlugin *p,
 		CompObject *o)
 {
     static InitPluginObjectProc dispTab[] = {
 	(InitPluginObjectProc) 0, /* InitCore */
-	(InitPluginObjectProc) textInitDisplay
+	(InitPluginObjectProc) textInitDisplay,
+	(InitPluginObjectProc) textInitScreen,
+	(InitPluginObjectProc) textInitWindow
     };
 
     RETURN_DISPATCH (o, dispTab, ARRAY_SIZE (dispTab), TRUE, (p, o));
@@ -653,7 +583,9 @@ textFiniObject (CompPlugin *p,
 {
     static FiniPluginObjectProc dispTab[] = {
 	(FiniPluginObjectProc) 0, /* FiniCore */
-	(FiniPluginObjectProc) textFiniDisplay
+	(FiniPluginObjectProc) textFiniDisplay,
+	(FiniPluginObjectProc) textFiniScreen,
+	(FiniPluginObjectProc) textFiniWindow
     };
 
     DISPATCH (o, dispTab, ARRAY_SIZE (dispTab), (p, o));
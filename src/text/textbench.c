@@ -0,0 +1,347 @@
+/*
+ * Compiz text plugin
+ *
+ * textbench.c
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+/*
+ * Measures and renders a set of window titles with every combination of
+ * the style, ellipsizing and background flags, using the same code as the
+ * plugin's measureText and renderText, and prints the per-call latency and
+ * the number of heap allocations for each. Binding the pixmap to a texture
+ * needs core and is left out. Run it against Xvfb for a headless setup.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "textrender.h"
+
+#define TEXT_BENCHMARK_FLAGS (CompTextFlagStyleBold   | \
+			      CompTextFlagStyleItalic | \
+			      CompTextFlagEllipsized  | \
+			      CompTextFlagWithBackground)
+
+/* window titles as they show up in the switchers and decorations */
+static const char *benchmarkTitles[] = {
+    "Terminal",
+    "Untitled Document 1 - gedit",
+    "Inbox (3) - someone@example.org - Mozilla Thunderbird",
+    "Новая вкладка - Chromium",
+    "Αρχική σελίδα - Mozilla Firefox",
+    "文件管理器 - 主文件夹",
+    "無題のドキュメント - テキストエディター",
+    "새 탭 - Mozilla Firefox",
+    "صفحة جديدة - Mozilla Firefox",
+    "מסמך ללא שם 1 - LibreOffice Writer",
+    "🎉 Release party 🎂 - Chat",
+    "Re: 会議の議題 / meeting agenda 📅 - Evolution",
+    "/usr/share/doc/compiz-plugins-main/examples/configuration/"
+    "very/deeply/nested/directory/structure/with/a/rather/long/"
+    "file-name-that-does-not-fit-anywhere.conf (~/src/compiz/"
+    "plugins-main/build/debug/x86_64-linux-gnu) - VIM",
+    "Tab 1 | Tab 2 | Tab 3 | Tab 4 | Tab 5 | Tab 6 | Tab 7 | Tab 8 | "
+    "Tab 9 | Tab 10 | Tab 11 | Tab 12 | Tab 13 | Tab 14 | Tab 15 | "
+    "Tab 16 | Tab 17 | Tab 18 | Tab 19 | Tab 20 - Mozilla Firefox"
+};
+
+typedef struct _TextBenchStats {
+    long          *times;  /* per-call latency in microseconds */
+    int           nCalls;
+    unsigned long allocs;  /* heap allocations over all calls */
+    unsigned long bytes;   /* bytes requested by them */
+} TextBenchStats;
+
+/*
+ * Count the allocations made by us and by the libraries, glib, cairo and
+ * pango included, by wrapping glibc's allocator
+ */
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t nmemb, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+static unsigned long nAllocs;
+static unsigned long nAllocBytes;
+
+void *
+malloc (size_t size)
+{
+    nAllocs++;
+    nAllocBytes += size;
+
+    return __libc_malloc (size);
+}
+
+void *
+calloc (size_t nmemb,
+	size_t size)
+{
+    nAllocs++;
+    nAllocBytes += nmemb * size;
+
+    return __libc_calloc (nmemb, size);
+}
+
+void *
+realloc (void   *ptr,
+	 size_t size)
+{
+    nAllocs++;
+    nAllocBytes += size;
+
+    return __libc_realloc (ptr, size);
+}
+
+/* textrender logs through core, which is not around here */
+void
+compLogMessage (const char   *componentName,
+		CompLogLevel level,
+		const char   *format,
+		...)
+{
+    va_list args;
+
+    va_start (args, format);
+
+    fprintf (stderr, "%s: ", componentName);
+    vfprintf (stderr, format, args);
+    fprintf (stderr, "\n");
+
+    va_end (args);
+}
+
+static long
+benchGetTimeDiffUs (const struct timeval *t1,
+		    const struct timeval *t0)
+{
+    return (t1->tv_sec - t0->tv_sec) * 1000000 +
+	   (t1->tv_usec - t0->tv_usec);
+}
+
+static int
+benchCompareTimes (const void *a,
+		   const void *b)
+{
+    long ta = *(const long *) a;
+    long tb = *(const long *) b;
+
+    return (ta > tb) - (ta < tb);
+}
+
+static void
+benchPrintStats (const char     *name,
+		 unsigned int   flags,
+		 TextBenchStats *stats)
+{
+    int n = stats->nCalls;
+
+    if (!n)
+    {
+	printf ("%-11s flags 0x%x: no successful calls\n", name, flags);
+	return;
+    }
+
+    qsort (stats->times, n, sizeof (long), benchCompareTimes);
+
+    printf ("%-11s flags 0x%x: %d calls, p50 %.3fms, p90 %.3fms, "
+	    "p99 %.3fms, max %.3fms, %.1f allocations (%lu bytes) per call\n",
+	    name, flags, n,
+	    stats->times[n * 50 / 100] / 1000.0,
+	    stats->times[n * 90 / 100] / 1000.0,
+	    stats->times[n * 99 / 100] / 1000.0,
+	    stats->times[n - 1] / 1000.0,
+	    (double) stats->allocs / n, stats->bytes / n);
+}
+
+static void
+benchMeasure (TextMeasureLayout    *measure,
+	      const char           *text,
+	      const CompTextAttrib *attrib,
+	      TextBenchStats       *stats)
+{
+    CompTextExtents extents;
+    struct timeval  start, end;
+    unsigned long   allocs = nAllocs, bytes = nAllocBytes;
+
+    gettimeofday (&start, 0);
+    textMeasureLayoutText (measure, text, attrib, &extents);
+    gettimeofday (&end, 0);
+
+    stats->allocs += nAllocs - allocs;
+    stats->bytes  += nAllocBytes - bytes;
+    stats->times[stats->nCalls++] = benchGetTimeDiffUs (&end, &start);
+}
+
+static void
+benchRender (Display              *dpy,
+	     int                  screenNum,
+	     const char           *text,
+	     const CompTextAttrib *attrib,
+	     TextBenchStats       *stats)
+{
+    struct timeval start, end;
+    unsigned long  allocs = nAllocs, bytes = nAllocBytes;
+    Pixmap         pixmap;
+    int            width, height;
+    Bool           status;
+
+    gettimeofday (&start, 0);
+    status = textRenderTextToPixmap (dpy, screenNum, text, attrib,
+				     &pixmap, &width, &height);
+    /* include the drawing the server does for us */
+    XSync (dpy, False);
+    gettimeofday (&end, 0);
+
+    if (!status)
+	return;
+
+    stats->allocs += nAllocs - allocs;
+    stats->bytes  += nAllocBytes - bytes;
+    stats->times[stats->nCalls++] = benchGetTimeDiffUs (&end, &start);
+
+    XFreePixmap (dpy, pixmap);
+}
+
+static void
+usage (const char *name)
+{
+    fprintf (stderr,
+	     "Usage: %s [-n rounds] [-f family] [-s size] [-w width]\n"
+	     "\n"
+	     "  -n  times every title is measured and rendered (10)\n"
+	     "  -f  font family (Sans)\n"
+	     "  -s  font size (12)\n"
+	     "  -w  maximum width of the text (300)\n",
+	     name);
+}
+
+int
+main (int  argc,
+      char **argv)
+{
+    Display           *dpy;
+    TextMeasureLayout measure;
+    CompTextAttrib    attrib;
+    TextBenchStats    measureStats, renderStats;
+    unsigned int      flags;
+    int               screenNum, rounds = 10, nCalls, round, i, opt;
+
+    memset (&attrib, 0, sizeof (CompTextAttrib));
+
+    attrib.family    = "Sans";
+    attrib.size      = 12;
+    attrib.maxWidth  = 300;
+    attrib.maxHeight = 100;
+    attrib.bgHMargin = 10;
+    attrib.bgVMargin = 5;
+
+    attrib.color[0] = attrib.color[1] = attrib.color[2] = 0xffff;
+    attrib.color[3] = 0xffff;
+    attrib.bgColor[3] = 0xcccc;
+
+    while ((opt = getopt (argc, argv, "n:f:s:w:")) != -1)
+    {
+	switch (opt) {
+	case 'n':
+	    rounds = atoi (optarg);
+	    break;
+	case 'f':
+	    attrib.family = optarg;
+	    break;
+	case 's':
+	    attrib.size = atoi (optarg);
+	    break;
+	case 'w':
+	    attrib.maxWidth = atoi (optarg);
+	    break;
+	default:
+	    usage (argv[0]);
+	    return 2;
+	}
+    }
+
+    if (optind != argc || rounds < 1 || attrib.size < 1 ||
+	attrib.maxWidth <= 2 * attrib.bgHMargin)
+    {
+	usage (argv[0]);
+	return 2;
+    }
+
+    dpy = XOpenDisplay (NULL);
+    if (!dpy)
+    {
+	fprintf (stderr, "Cannot open display \"%s\"\n", XDisplayName (NULL));
+	return 1;
+    }
+
+    screenNum = DefaultScreen (dpy);
+
+    /* the plugin keeps its measuring layout around as well */
+    memset (&measure, 0, sizeof (TextMeasureLayout));
+    if (!textInitMeasureLayout (dpy, screenNum, &measure))
+    {
+	XCloseDisplay (dpy);
+	return 1;
+    }
+
+    nCalls = rounds * ARRAY_SIZE (benchmarkTitles);
+
+    measureStats.times = malloc (nCalls * sizeof (long));
+    renderStats.times  = malloc (nCalls * sizeof (long));
+    if (!measureStats.times || !renderStats.times)
+    {
+	fprintf (stderr, "Out of memory\n");
+	return 1;
+    }
+
+    for (flags = 0; flags <= TEXT_BENCHMARK_FLAGS; flags++)
+    {
+	attrib.flags = flags;
+
+	measureStats.nCalls = renderStats.nCalls = 0;
+	measureStats.allocs = renderStats.allocs = 0;
+	measureStats.bytes  = renderStats.bytes  = 0;
+
+	for (round = 0; round < rounds; round++)
+	{
+	    for (i = 0; i < (int) ARRAY_SIZE (benchmarkTitles); i++)
+	    {
+		benchMeasure (&measure, benchmarkTitles[i], &attrib,
+			      &measureStats);
+		benchRender (dpy, screenNum, benchmarkTitles[i], &attrib,
+			     &renderStats);
+	    }
+	}
+
+	benchPrintStats ("measureText", flags, &measureStats);
+	benchPrintStats ("renderText", flags, &renderStats);
+    }
+
+    free (measureStats.times);
+    free (renderStats.times);
+
+    textFiniMeasureLayout (&measure);
+
+    XCloseDisplay (dpy);
+
+    return 0;
+}
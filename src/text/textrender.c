@@ -0,0 +1,449 @@
+/*
+ * Compiz text plugin
+ * Description: Adds text to pixmap support to Compiz.
+ *
+ * textrender.c
+ *
+ * Copyright: (C) 2006-2007 Patrick Niklaus, Danny Baumann, Dennis Kasprzyk
+ * Authors: Patrick Niklaus <marex@opencompsiting.org>
+ *	    Danny Baumann   <dannybaumann@web.de>
+ *	    Dennis Kasprzyk <onestone@compiz.org>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#include <string.h>
+
+#include <cairo-xlib-xrender.h>
+#include <pango/pangocairo.h>
+
+#include "textrender.h"
+
+#define PI 3.14159265359f
+
+typedef struct _TextSurfaceData {
+    int                  width;
+    int                  height;
+
+    cairo_t              *cr;
+    cairo_surface_t      *surface;
+    PangoLayout          *layout;
+    Pixmap               pixmap;
+    XRenderPictFormat    *format;
+    PangoFontDescription *font;
+    Screen               *screen;
+} TextSurfaceData;
+
+/*
+ * Draw a rounded rectangle path
+ */
+static void
+textDrawTextBackground (cairo_t *cr,
+			int     x,
+			int     y,
+			int     width,
+			int     height,
+			int     radius)
+{
+    int x0, y0, x1, y1;
+
+    x0 = x;
+    y0 = y;
+    x1 = x + width;
+    y1 = y + height;
+
+    cairo_new_path (cr);
+    cairo_arc (cr, x0 + radius, y1 - radius, radius, PI / 2, PI);
+    cairo_line_to (cr, x0, y0 + radius);
+    cairo_arc (cr, x0 + radius, y0 + radius, radius, PI, 3 * PI / 2);
+    cairo_line_to (cr, x1 - radius, y0);
+    cairo_arc (cr, x1 - radius, y0 + radius, radius, 3 * PI / 2, 2 * PI);
+    cairo_line_to (cr, x1, y1 - radius);
+    cairo_arc (cr, x1 - radius, y1 - radius, radius, 0, PI / 2);
+    cairo_close_path (cr);
+}
+
+static Bool
+textInitCairo (TextSurfaceData *data,
+	       int             width,
+	       int             height)
+{
+    Display *dpy = DisplayOfScreen (data->screen);
+
+    data->pixmap = None;
+    if (width > 0 && height > 0)
+	data->pixmap = XCreatePixmap (dpy, RootWindowOfScreen (data->screen),
+				      width, height, 32);
+
+    data->width  = width;
+    data->height = height;
+
+    if (!data->pixmap)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create %d x %d pixmap.", width, height);
+	return FALSE;
+    }
+
+    data->surface = cairo_xlib_surface_create_with_xrender_format (dpy,
+								   data->pixmap,
+								   data->screen,
+								   data->format,
+								   width,
+								   height);
+    if (cairo_surface_status (data->surface) != CAIRO_STATUS_SUCCESS)
+    {
+	compLogMessage ("text", CompLogLevelError, "Couldn't create surface.");
+	return FALSE;
+    }
+
+    data->cr = cairo_create (data->surface);
+    if (cairo_status (data->cr) != CAIRO_STATUS_SUCCESS)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create cairo context.");
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static Bool
+textInitSurface (Display         *dpy,
+		 int             screenNum,
+		 TextSurfaceData *data)
+{
+    data->screen = ScreenOfDisplay (dpy, screenNum);
+    if (!data->screen)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't get screen for %d.", screenNum);
+	return FALSE;
+    }
+
+    data->format = XRenderFindStandardFormat (dpy, PictStandardARGB32);
+    if (!data->format)
+    {
+	compLogMessage ("text", CompLogLevelError, "Couldn't get format.");
+	return FALSE;
+    }
+
+    if (!textInitCairo (data, 1, 1))
+	return FALSE;
+
+    /* init pango */
+    data->layout = pango_cairo_create_layout (data->cr);
+    if (!data->layout)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create pango layout.");
+	return FALSE;
+    }
+
+    data->font = pango_font_description_new ();
+    if (!data->font)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create font description.");
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+static Bool
+textUpdateSurface (TextSurfaceData *data,
+		   int             width,
+		   int             height)
+{
+    Display *dpy = DisplayOfScreen (data->screen);
+
+    cairo_surface_destroy (data->surface);
+    data->surface = NULL;
+
+    cairo_destroy (data->cr);
+    data->cr = NULL;
+
+    XFreePixmap (dpy, data->pixmap);
+    data->pixmap = None;
+
+    return textInitCairo (data, width, height);
+}
+
+/*
+ * Apply the text and the attributes to a layout and calculate
+ * the pixmap size needed for rendering it
+ */
+static void
+textLayoutText (PangoLayout          *layout,
+		PangoFontDescription *font,
+		const char           *text,
+		const CompTextAttrib *attrib,
+		int                  *width,
+		int                  *height)
+{
+    int layoutWidth;
+
+    pango_font_description_set_family (font, attrib->family);
+    pango_font_description_set_absolute_size (font,
+					      attrib->size * PANGO_SCALE);
+    pango_font_description_set_style (font, PANGO_STYLE_NORMAL);
+    pango_font_description_set_weight (font, PANGO_WEIGHT_NORMAL);
+
+    if (attrib->flags & CompTextFlagStyleBold)
+	pango_font_description_set_weight (font, PANGO_WEIGHT_BOLD);
+
+    if (attrib->flags & CompTextFlagStyleItalic)
+	pango_font_description_set_style (font, PANGO_STYLE_ITALIC);
+
+    pango_layout_set_font_description (layout, font);
+
+    if (attrib->flags & CompTextFlagEllipsized)
+	pango_layout_set_ellipsize (layout, PANGO_ELLIPSIZE_END);
+    else
+	pango_layout_set_ellipsize (layout, PANGO_ELLIPSIZE_NONE);
+
+    pango_layout_set_width (layout, -1);
+    pango_layout_set_auto_dir (layout, FALSE);
+    pango_layout_set_text (layout, text, -1);
+
+    pango_layout_get_pixel_size (layout, width, height);
+
+    if (attrib->flags & CompTextFlagWithBackground)
+    {
+	*width  += 2 * attrib->bgHMargin;
+	*height += 2 * attrib->bgVMargin;
+    }
+
+    *width  = MIN (attrib->maxWidth, *width);
+    *height = MIN (attrib->maxHeight, *height);
+
+    /* update the size of the pango layout */
+    layoutWidth = attrib->maxWidth;
+    if (attrib->flags & CompTextFlagWithBackground)
+	layoutWidth -= 2 * attrib->bgHMargin;
+
+    pango_layout_set_width (layout, layoutWidth * PANGO_SCALE);
+}
+
+static Bool
+textRenderTextToSurface (const char           *text,
+			 TextSurfaceData      *data,
+			 const CompTextAttrib *attrib)
+{
+    int width, height;
+
+    textLayoutText (data->layout, data->font, text, attrib, &width, &height);
+
+    if (!textUpdateSurface (data, width, height))
+	return FALSE;
+
+    pango_cairo_update_layout (data->cr, data->layout);
+
+    cairo_save (data->cr);
+    cairo_set_operator (data->cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint (data->cr);
+    cairo_restore (data->cr);
+
+    cairo_set_operator (data->cr, CAIRO_OPERATOR_OVER);
+
+    if (attrib->flags & CompTextFlagWithBackground)
+    {
+	textDrawTextBackground (data->cr, 0, 0, width, height,
+				MIN (attrib->bgHMargin, attrib->bgVMargin));
+	cairo_set_source_rgba (data->cr,
+			       attrib->bgColor[0] / 65535.0,
+			       attrib->bgColor[1] / 65535.0,
+			       attrib->bgColor[2] / 65535.0,
+			       attrib->bgColor[3] / 65535.0);
+	cairo_fill (data->cr);
+	cairo_move_to (data->cr, attrib->bgHMargin, attrib->bgVMargin);
+    }
+
+    cairo_set_source_rgba (data->cr,
+			   attrib->color[0] / 65535.0,
+			   attrib->color[1] / 65535.0,
+			   attrib->color[2] / 65535.0,
+			   attrib->color[3] / 65535.0);
+
+    pango_cairo_show_layout (data->cr, data->layout);
+
+    return TRUE;
+}
+
+static void
+textCleanupSurface (TextSurfaceData *data)
+{
+    if (data->layout)
+	g_object_unref (data->layout);
+    if (data->surface)
+	cairo_surface_destroy (data->surface);
+    if (data->cr)
+	cairo_destroy (data->cr);
+    if (data->font)
+	pango_font_description_free (data->font);
+}
+
+
+Bool
+textRenderTextToPixmap (Display              *dpy,
+			int                  screenNum,
+			const char           *text,
+			const CompTextAttrib *attrib,
+			Pixmap               *pixmap,
+			int                  *width,
+			int                  *height)
+{
+    TextSurfaceData surface;
+    Bool            status;
+
+    memset (&surface, 0, sizeof (TextSurfaceData));
+
+    status = textInitSurface (dpy, screenNum, &surface) &&
+	     textRenderTextToSurface (text, &surface, attrib);
+
+    if (status)
+    {
+	*pixmap = surface.pixmap;
+	*width  = surface.width;
+	*height = surface.height;
+    }
+    else if (surface.pixmap)
+    {
+	XFreePixmap (dpy, surface.pixmap);
+    }
+
+    textCleanupSurface (&surface);
+
+    return status;
+}
+
+void
+textFiniMeasureLayout (TextMeasureLayout *measure)
+{
+    if (measure->layout)
+	g_object_unref (measure->layout);
+    if (measure->context)
+	g_object_unref (measure->context);
+    if (measure->font)
+	pango_font_description_free (measure->font);
+
+    measure->layout  = NULL;
+    measure->context = NULL;
+    measure->font    = NULL;
+}
+
+/*
+ * Copy the font options and resolution a rendering layout would get from
+ * its xlib surface, so that hinting and antialiasing and with them the
+ * measured extents match what textRenderText produces
+ */
+static Bool
+textUpdateMeasureContext (Display      *dpy,
+			  int          screenNum,
+			  PangoContext *context)
+{
+    TextSurfaceData      surface;
+    cairo_font_options_t *options;
+    PangoContext         *renderContext;
+
+    memset (&surface, 0, sizeof (TextSurfaceData));
+
+    if (!textInitSurface (dpy, screenNum, &surface))
+    {
+	if (surface.pixmap)
+	    XFreePixmap (dpy, surface.pixmap);
+	textCleanupSurface (&surface);
+	return FALSE;
+    }
+
+    options = cairo_font_options_create ();
+    cairo_surface_get_font_options (surface.surface, options);
+    pango_cairo_context_set_font_options (context, options);
+    cairo_font_options_destroy (options);
+
+    renderContext = pango_layout_get_context (surface.layout);
+    pango_cairo_context_set_resolution (context,
+					pango_cairo_context_get_resolution (renderContext));
+
+    XFreePixmap (dpy, surface.pixmap);
+    textCleanupSurface (&surface);
+
+    return TRUE;
+}
+
+Bool
+textInitMeasureLayout (Display           *dpy,
+		       int               screenNum,
+		       TextMeasureLayout *measure)
+{
+    PangoFontMap *fontMap;
+
+    fontMap = pango_cairo_font_map_get_default ();
+
+    measure->context = pango_font_map_create_context (fontMap);
+    if (!measure->context)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create pango context.");
+	return FALSE;
+    }
+
+    if (!textUpdateMeasureContext (dpy, screenNum, measure->context))
+    {
+	textFiniMeasureLayout (measure);
+	return FALSE;
+    }
+
+    measure->layout = pango_layout_new (measure->context);
+    if (!measure->layout)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create pango layout.");
+	textFiniMeasureLayout (measure);
+	return FALSE;
+    }
+
+    measure->font = pango_font_description_new ();
+    if (!measure->font)
+    {
+	compLogMessage ("text", CompLogLevelError,
+			"Couldn't create font description.");
+	textFiniMeasureLayout (measure);
+	return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+textMeasureLayoutText (TextMeasureLayout    *measure,
+		       const char           *text,
+		       const CompTextAttrib *attrib,
+		       CompTextExtents      *extents)
+{
+    int width, height, textWidth;
+
+    textLayoutText (measure->layout, measure->font, text, attrib,
+		    &width, &height);
+
+    pango_layout_get_pixel_size (measure->layout, &textWidth, NULL);
+
+    extents->width      = width;
+    extents->height     = height;
+    extents->textWidth  = MAX (textWidth, 0);
+    extents->ellipsized = pango_layout_is_ellipsized (measure->layout);
+}
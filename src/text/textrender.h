@@ -0,0 +1,66 @@
+/*
+ * Compiz text plugin
+ *
+ * textrender.h
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ *
+ */
+
+#ifndef _TEXT_RENDER_H
+#define _TEXT_RENDER_H
+
+#include <pango/pango.h>
+
+#include <compiz-core.h>
+#include "compiz-text.h"
+
+/*
+ * Laying out and drawing text into pixmaps only needs Xlib, cairo and
+ * pango, so that part of the plugin is kept apart from core and can be
+ * used by textbench as well. Errors are reported with compLogMessage.
+ */
+
+/* surface-less layout used for measuring only */
+typedef struct _TextMeasureLayout {
+    PangoContext         *context;
+    PangoLayout          *layout;
+    PangoFontDescription *font;
+} TextMeasureLayout;
+
+Bool
+textRenderTextToPixmap (Display              *dpy,
+			int                  screenNum,
+			const char           *text,
+			const CompTextAttrib *attrib,
+			Pixmap               *pixmap,
+			int                  *width,
+			int                  *height);
+
+Bool
+textInitMeasureLayout (Display           *dpy,
+		       int               screenNum,
+		       TextMeasureLayout *measure);
+
+void
+textFiniMeasureLayout (TextMeasureLayout *measure);
+
+void
+textMeasureLayoutText (TextMeasureLayout    *measure,
+		       const char           *text,
+		       const CompTextAttrib *attrib,
+		       CompTextExtents      *extents);
+
+#endif
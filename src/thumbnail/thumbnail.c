@@ -58,6 +58,9 @@
 
 #define TEXT_DISTANCE 10
 
+/* hover detection does not need the full mousepoll rate */
+#define POSITION_POLL_INTERVAL 50
+
 static int displayPrivateIndex;
 
 typedef struct _ThumbDisplay
@@ -582,7 +585,8 @@ thumbHandleEvent (CompDisplay * d,
 		if (!ts->pollHandle)
 		{
 		    ts->pollHandle =
-			(*td->mpFunc->addPositionPolling) (s, positionUpdate);
+			(*td->mpFunc->addPositionPollingWithRate) (
+			    s, positionUpdate, POSITION_POLL_INTERVAL);
 		}
 	    }
 	    else